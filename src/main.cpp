@@ -11,6 +11,7 @@
 #include "renderer/renderer.hpp"
 #include "voxels/voxel_world.hpp"
 #include "utilities/debug.hpp"
+#include "utilities/thread_pool.hpp"
 
 #include <GLFW/glfw3.h>
 
@@ -61,6 +62,8 @@ void on_resize(AppState &self) {
 void init(AppState &self) {
     self.window_info = {.width = 800, .height = 600};
     self.paused = true;
+    // Leave a hardware thread to the main thread, which records and submits every frame
+    thread_pool::configure({.reserved_thread_count = 1});
     self.player = player::create();
 
     self.voxel_world = voxel_world::create();
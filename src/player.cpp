@@ -629,6 +629,8 @@ void player::update(Player *self, float dt) {
         }
     }
 
+    voxel_world::set_view_position(g_voxel_world, &self->main.pos.x);
+
     auto ray_pos = self->main.pos + self->main.cam_pos_offset + view_vec(&self->main);
     self->ray_cast = voxel_world::ray_cast(g_voxel_world, {&ray_pos.x, &self->main.forward.x});
     if (self->ray_cast.distance != -1.0f && self->ray_cast.distance < 8.0f) {
@@ -2,6 +2,7 @@
 #include "renderer.hpp"
 #include "../player.hpp"
 #include "utilities/debug.hpp"
+#include "utilities/thread_pool.hpp"
 #include "voxels/defs.inl"
 #include <daxa/c/core.h>
 #include <daxa/command_recorder.hpp>
@@ -605,6 +606,7 @@ void update(Renderer *self) {
                             .blas_build_infos = std::array{chunk->blas_build_info},
                         });
                         ti.recorder.destroy_buffer_deferred(chunk->blas_scratch_buffer);
+                        chunk->blas_scratch_buffer = {};
                     }
                 }
             },
@@ -699,6 +701,43 @@ void render_ui(Renderer *self) {
         ImGui::Text(" LMB    | Break voxels");
         ImGui::Text(" RMB    | Place voxels");
     }
+    if (ImGui::CollapsingHeader("Thread pool")) {
+        static auto collect_stats = false;
+        if (ImGui::Checkbox("Collect stats", &collect_stats)) {
+            thread_pool::set_stats_enabled(collect_stats);
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Log")) {
+            thread_pool::log_stats();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Reset")) {
+            thread_pool::reset_stats();
+        }
+    }
+    if (ImGui::CollapsingHeader("Voxel world")) {
+        static auto remesh_budget = 4.0f;
+        if (ImGui::SliderFloat("Remesh budget (ms)", &remesh_budget, 0.0f, 16.0f)) {
+            voxel_world::set_remesh_budget(g_voxel_world, remesh_budget);
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Time per frame spent remeshing edited chunks, 0 means no limit");
+        }
+        static auto lod_downsampling = 0;
+        if (ImGui::Combo("LOD downsampling", &lod_downsampling, "Off\0Majority\0Any solid\0")) {
+            voxel_world::set_lod_downsampling(g_voxel_world, voxel_world::LodDownsampling(lod_downsampling));
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Builds coarser chunks from the finer ones still loaded instead of generating them");
+        }
+        static auto downsample_budget = 4.0f;
+        if (ImGui::SliderFloat("Downsample budget (ms)", &downsample_budget, 0.0f, 16.0f)) {
+            voxel_world::set_downsample_budget(g_voxel_world, downsample_budget);
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Time per frame spent downsampling chunks, 0 means no limit");
+        }
+    }
 
     {
         auto format_to_pixel_size = [](daxa::Format format) -> daxa_u32 {
@@ -881,38 +920,39 @@ auto renderer::create_chunk(Renderer *self, float const *pos) -> Chunk * {
     return new Chunk{.pos = {pos[0], pos[1], pos[2]}};
 }
 
+// Streaming retires chunks every frame, so everything the chunk owns has to go with it
 void renderer::destroy_chunk(Renderer *self, Chunk *chunk) {
+    auto &device = self->gpu_context.device;
+    if (!chunk->blas.is_empty()) {
+        device.destroy_blas(chunk->blas);
+    }
+    // only still around if the chunk never got to its blas build
+    if (!chunk->blas_scratch_buffer.is_empty()) {
+        device.destroy_buffer(chunk->blas_scratch_buffer);
+    }
+    if (!chunk->blas_buffer.is_empty()) {
+        device.destroy_buffer(chunk->blas_buffer);
+    }
     if (!chunk->brick_data.is_empty()) {
-        self->gpu_context.device.destroy_buffer(chunk->brick_data);
-        self->gpu_context.device.destroy_buffer(chunk->blas_buffer);
+        device.destroy_buffer(chunk->brick_data);
     }
+    delete chunk;
 }
 
-void renderer::update(Chunk *self, int brick_count, int const *surface_brick_indices, void const *const *bricks,
-                      int bitmask_offset, int render_attrib_ptr_offset, int pos_scl_offset) {
+void renderer::update(Chunk *self, int brick_count, VoxelBrickBitmask const *bitmasks, VoxelRenderAttribBrick const *const *render_attribs, int const *pos_scls) {
     self->needs_update = true;
     self->brick_count = brick_count;
 
-    self->bitmasks.clear();
-    self->bitmasks.reserve(brick_count);
-    for (int i = 0; i < brick_count; ++i) {
-        int brick_index = surface_brick_indices[i];
-        auto const *brick_ptr = bricks[brick_index];
-        auto const &bitmask = *reinterpret_cast<VoxelBrickBitmask const *>((uint8_t const *)brick_ptr + bitmask_offset);
-        self->bitmasks.push_back(bitmask);
-    }
+    self->bitmasks.assign(bitmasks, bitmasks + brick_count);
 
     self->attribs.clear();
     self->attribs.reserve(brick_count);
     for (int i = 0; i < brick_count; ++i) {
-        int brick_index = surface_brick_indices[i];
-        auto const *brick_ptr = bricks[brick_index];
-        auto const &attribs = *reinterpret_cast<VoxelRenderAttribBrick const *const *>((uint8_t const *)brick_ptr + render_attrib_ptr_offset);
-        self->attribs.push_back(*attribs);
+        self->attribs.push_back(*render_attribs[i]);
     }
 
-    self->positions.clear();
-    self->positions.reserve(brick_count * 4);
+    self->positions.assign(pos_scls, pos_scls + brick_count * 4);
+
     self->aabbs.clear();
     self->aabbs.reserve(brick_count);
     auto chunk_offset = daxa_f32vec3{
@@ -922,19 +962,12 @@ void renderer::update(Chunk *self, int brick_count, int const *surface_brick_ind
     };
 
     for (int i = 0; i < brick_count; ++i) {
-        int brick_index = surface_brick_indices[i];
-        auto const *brick_ptr = bricks[brick_index];
-        auto positions = reinterpret_cast<int const *>((uint8_t const *)brick_ptr + pos_scl_offset);
+        auto const *positions = pos_scls + i * 4;
         auto px = positions[0];
         auto py = positions[1];
         auto pz = positions[2];
         auto scl = positions[3] + 8;
 
-        self->positions.push_back(positions[0]);
-        self->positions.push_back(positions[1]);
-        self->positions.push_back(positions[2]);
-        self->positions.push_back(positions[3]);
-
 #define SCL (float(1 << scl) / float(1 << 8))
         float x0 = float(px * VOXEL_BRICK_SIZE + chunk_offset.x) * SCL;
         float y0 = float(py * VOXEL_BRICK_SIZE + chunk_offset.y) * SCL;
@@ -993,12 +1026,18 @@ void renderer::render_chunk(Renderer *self, Chunk *chunk) {
         };
         auto build_size_info = self->gpu_context.device.get_blas_build_sizes(chunk->blas_build_info);
         auto scratch_alignment_size = get_aligned(build_size_info.build_scratch_size, acceleration_structure_scratch_offset_alignment);
+        if (!chunk->blas_scratch_buffer.is_empty()) {
+            self->gpu_context.device.destroy_buffer(chunk->blas_scratch_buffer);
+        }
         chunk->blas_scratch_buffer = self->gpu_context.device.create_buffer({
             .size = scratch_alignment_size,
             .name = "blas_scratch_buffer",
         });
         chunk->blas_build_info.scratch_data = self->gpu_context.device.get_device_address(chunk->blas_scratch_buffer).value();
         auto build_aligment_size = get_aligned(build_size_info.acceleration_structure_size, ACCELERATION_STRUCTURE_BUILD_OFFSET_ALIGMENT);
+        if (!chunk->blas.is_empty()) {
+            self->gpu_context.device.destroy_blas(chunk->blas);
+        }
         if (!chunk->blas_buffer.is_empty()) {
             self->gpu_context.device.destroy_buffer(chunk->blas_buffer);
         }
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <type_traits>
+
+// Pool for fixed-size objects, addressed by 32-bit handles instead of pointers.
+// Objects live in 64-byte aligned slabs of SLAB_SIZE elements. Slabs are never moved
+// or released until the pool is destroyed, so resolving a handle doesn't need a lock.
+// Every thread keeps a small cache of free handles and only takes the pool mutex to
+// refill or spill that cache in batches.
+//
+// The thread caches are per element type, so there must only be one pool per T.
+template <typename T, uint32_t SLAB_SIZE_LOG2 = 12>
+struct SlabAllocator {
+    static_assert(std::is_trivially_destructible_v<T>);
+
+    using Handle = uint32_t;
+    static constexpr Handle INVALID_HANDLE = ~Handle{0};
+
+    static constexpr uint32_t SLAB_SIZE = 1u << SLAB_SIZE_LOG2;
+    // Keeps the top 4 bits of every handle clear, so users can reserve sentinel values there.
+    static constexpr uint32_t MAX_SLAB_COUNT = 1u << (28 - SLAB_SIZE_LOG2);
+    static constexpr uint32_t CACHE_BATCH_SIZE = 64;
+    static constexpr size_t SLAB_ALIGNMENT = 64;
+
+    SlabAllocator() = default;
+    SlabAllocator(SlabAllocator const &) = delete;
+    SlabAllocator &operator=(SlabAllocator const &) = delete;
+    SlabAllocator(SlabAllocator &&) = delete;
+    SlabAllocator &operator=(SlabAllocator &&) = delete;
+
+    ~SlabAllocator() {
+        for (uint32_t slab_i = 0; slab_i < slab_count; ++slab_i) {
+            ::operator delete(slabs[slab_i].load(std::memory_order_relaxed), std::align_val_t{SLAB_ALIGNMENT});
+        }
+    }
+
+    // The returned object is default-initialized, which means trivial types are left uninitialized.
+    auto allocate() -> Handle {
+        auto &cache = thread_cache();
+        if (cache.empty()) {
+            refill(cache);
+        }
+        auto handle = cache.back();
+        cache.pop_back();
+        new (get(handle)) T;
+        return handle;
+    }
+
+    void free(Handle handle) {
+        auto &cache = thread_cache();
+        cache.push_back(handle);
+        if (cache.size() >= CACHE_BATCH_SIZE * 2) {
+            auto lock = std::lock_guard{mutex};
+            free_list.insert(free_list.end(), cache.end() - CACHE_BATCH_SIZE, cache.end());
+            cache.resize(cache.size() - CACHE_BATCH_SIZE);
+        }
+    }
+
+    auto get(Handle handle) const -> T * {
+        return slabs[handle >> SLAB_SIZE_LOG2].load(std::memory_order_relaxed) + (handle & (SLAB_SIZE - 1));
+    }
+
+  private:
+    static auto thread_cache() -> std::vector<Handle> & {
+        thread_local auto cache = std::vector<Handle>{};
+        return cache;
+    }
+
+    void refill(std::vector<Handle> &cache) {
+        auto lock = std::lock_guard{mutex};
+        while (cache.size() < CACHE_BATCH_SIZE && !free_list.empty()) {
+            cache.push_back(free_list.back());
+            free_list.pop_back();
+        }
+        while (cache.size() < CACHE_BATCH_SIZE) {
+            if ((next_handle & (SLAB_SIZE - 1)) == 0 && (next_handle >> SLAB_SIZE_LOG2) == slab_count) {
+                if (slab_count == MAX_SLAB_COUNT) {
+                    throw std::bad_alloc{};
+                }
+                auto *slab = static_cast<T *>(::operator new(sizeof(T) * SLAB_SIZE, std::align_val_t{SLAB_ALIGNMENT}));
+                slabs[slab_count].store(slab, std::memory_order_relaxed);
+                ++slab_count;
+            }
+            cache.push_back(next_handle);
+            ++next_handle;
+        }
+    }
+
+    std::unique_ptr<std::atomic<T *>[]> slabs = std::make_unique<std::atomic<T *>[]>(MAX_SLAB_COUNT);
+    uint32_t slab_count = 0;
+    Handle next_handle = 0;
+    std::mutex mutex = {};
+    std::vector<Handle> free_list = {};
+};
@@ -1,38 +1,264 @@
 #include "thread_pool.hpp"
 
 #include <thread>
-#include <optional>
 #include <vector>
 #include <deque>
 #include <condition_variable>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <limits>
+#include <cstdlib>
+#include <chrono>
+#include <bit>
 
-enum struct TaskPriority {
-    LOW,
-    HIGH
-};
+#include <fmt/format.h>
+#include "debug.hpp"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <filesystem>
+#include <string>
+#endif
+
+using thread_pool::TaskPriority;
+static constexpr uint32_t TASK_PRIORITY_COUNT = 2;
 
 struct VirtualTask {
     virtual ~VirtualTask() = default;
     virtual void callback(uint32_t chunk_index, uint32_t thread_index) = 0;
 
     uint32_t chunk_count = {};
-    uint32_t not_finished = {};
-    uint32_t started = {};
+    TaskPriority priority = {};
+    // The chunks plus one for completing the task, which runs the continuations
+    std::atomic_uint32_t not_finished = {};
+    // Threads asleep in block_on() on this task, so that finishing a task only notifies when someone waits for it
+    std::atomic_uint32_t waiter_count = {};
+    // The run in the high 32 bits and the next chunk to claim in the low ones. Chunks are claimed by whichever
+    // thread increments this first, so a task only needs one queue entry. An entry left over from an earlier
+    // run can't claim anything once the task is dispatched again, since the run no longer matches.
+    std::atomic_uint64_t next_chunk = {};
+
+    // One for the dispatch itself plus one per unfinished dependency, the task is queued once this reaches 0.
+    // Reset once the task completes, so dependencies only hold for a single run.
+    std::atomic_uint32_t pending_dependencies = 1;
+    std::mutex continuations_mutex = {};
+    std::vector<std::shared_ptr<VirtualTask>> continuations = {};
+
+    // Only set when the run was queued while stats were enabled
+    bool is_tracked = false;
+    int64_t queued_time = {};
+    int64_t start_time = {};
 };
 
-struct TaskChunk {
-    std::shared_ptr<VirtualTask> task = {};
-    uint32_t chunk_index = {};
+static auto get_time_ns() -> int64_t {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Histogram {
+    std::atomic_uint64_t buckets[thread_pool::Stats::HISTOGRAM_BUCKET_COUNT] = {};
+
+    void add(uint64_t value) {
+        auto bucket_i = std::min<uint32_t>(std::max<uint32_t>(std::bit_width(value), 1) - 1, thread_pool::Stats::HISTOGRAM_BUCKET_COUNT - 1);
+        buckets[bucket_i].fetch_add(1, std::memory_order_relaxed);
+    }
+    void read(uint64_t *result) const {
+        for (uint32_t bucket_i = 0; bucket_i < thread_pool::Stats::HISTOGRAM_BUCKET_COUNT; ++bucket_i) {
+            result[bucket_i] = buckets[bucket_i].load(std::memory_order_relaxed);
+        }
+    }
+    void reset() {
+        for (auto &bucket : buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+// Every worker only writes its own, so these don't need to be more than relaxed
+struct alignas(64) WorkerStatsCounters {
+    std::atomic_uint64_t executed_chunk_count = {};
+    std::atomic_uint64_t stolen_task_count = {};
+    std::atomic_int64_t busy_time = {};
+    std::atomic_int64_t idle_time = {};
+};
+
+// The queue entry of a dispatched task. There is one per dispatch, and whoever claims a chunk that isn't
+// the last one puts it back, so that idle threads can steal the rest. It keeps the task alive while queued.
+struct QueuedTask {
+    std::shared_ptr<VirtualTask> task;
+    TaskPriority priority;
+    uint32_t run_index;
+};
+
+static auto get_run_index(VirtualTask const &task) -> uint32_t {
+    return uint32_t(task.next_chunk.load(std::memory_order_relaxed) >> 32);
+}
+
+// Returns chunk_count if every chunk of the run is already taken, or if the task has moved on to another run
+static auto claim_chunk(VirtualTask &task, uint32_t run_index) -> uint32_t {
+    auto next = task.next_chunk.load(std::memory_order_relaxed);
+    while (true) {
+        auto const chunk_index = uint32_t(next);
+        if (uint32_t(next >> 32) != run_index || chunk_index >= task.chunk_count) {
+            return task.chunk_count;
+        }
+        if (task.next_chunk.compare_exchange_weak(next, next + 1, std::memory_order_relaxed)) {
+            return chunk_index;
+        }
+    }
+}
+
+// Chase-Lev work-stealing deque (Lê et al., "Correct and Efficient Work-Stealing for Weak Memory Models").
+// Only the owning worker pushes and pops at the bottom, any thread may steal from the top.
+struct WorkStealingDeque {
+    struct Ring {
+        int64_t capacity;
+        std::unique_ptr<std::atomic<QueuedTask *>[]> items;
+
+        explicit Ring(int64_t capacity) : capacity{capacity}, items{std::make_unique<std::atomic<QueuedTask *>[]>(size_t(capacity))} {}
+        auto get(int64_t i) const -> QueuedTask * { return items[i & (capacity - 1)].load(std::memory_order_relaxed); }
+        void put(int64_t i, QueuedTask *item) { items[i & (capacity - 1)].store(item, std::memory_order_relaxed); }
+    };
+
+    std::atomic_int64_t top = 0;
+    std::atomic_int64_t bottom = 0;
+    std::atomic<Ring *> ring = {};
+    // Thieves may still be reading from a ring after it has been outgrown, so they're only freed with the deque
+    std::vector<std::unique_ptr<Ring>> rings = {};
+
+    WorkStealingDeque() {
+        rings.push_back(std::make_unique<Ring>(64));
+        ring.store(rings.back().get(), std::memory_order_relaxed);
+    }
+
+    void push(QueuedTask *item) {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_acquire);
+        auto *a = ring.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1) {
+            auto bigger = std::make_unique<Ring>(a->capacity * 2);
+            for (auto i = t; i < b; ++i) {
+                bigger->put(i, a->get(i));
+            }
+            a = bigger.get();
+            rings.push_back(std::move(bigger));
+            ring.store(a, std::memory_order_release);
+        }
+        a->put(b, item);
+        bottom.store(b + 1, std::memory_order_release);
+    }
+
+    auto pop() -> QueuedTask * {
+        auto b = bottom.load(std::memory_order_relaxed) - 1;
+        auto *a = ring.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        auto *item = a->get(b);
+        if (t == b) {
+            // last item, race the thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    auto steal() -> QueuedTask * {
+        auto t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        auto *a = ring.load(std::memory_order_acquire);
+        auto *item = a->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    auto maybe_empty() const -> bool {
+        return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+    }
 };
 
-static constexpr uint32_t EXIT_CHUNK_CODE = std::numeric_limits<uint32_t>::max();
-static constexpr uint32_t NO_MORE_CHUNKS_CODE = std::numeric_limits<uint32_t>::max();
+struct CpuInfo {
+    uint32_t cpu;
+    uint32_t numa_node;
+};
+
+// The CPUs this process is allowed to run on, grouped by NUMA node
+static auto get_available_cpus() -> std::vector<CpuInfo> {
+    auto result = std::vector<CpuInfo>{};
+#if defined(_WIN32)
+    auto process_mask = DWORD_PTR{};
+    auto system_mask = DWORD_PTR{};
+    if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) {
+        for (uint32_t cpu = 0; cpu < sizeof(DWORD_PTR) * 8; ++cpu) {
+            if ((process_mask & (DWORD_PTR{1} << cpu)) == 0) {
+                continue;
+            }
+            auto numa_node = UCHAR{};
+            if (!GetNumaProcessorNode(UCHAR(cpu), &numa_node) || numa_node == 0xff) {
+                numa_node = 0;
+            }
+            result.push_back({cpu, numa_node});
+        }
+    }
+#elif defined(__linux__)
+    auto cpu_set = cpu_set_t{};
+    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
+        for (uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (!CPU_ISSET(cpu, &cpu_set)) {
+                continue;
+            }
+            // sysfs has a "node<N>" link in the directory of every CPU
+            auto numa_node = 0u;
+            auto ec = std::error_code{};
+            for (auto const &entry : std::filesystem::directory_iterator("/sys/devices/system/cpu/cpu" + std::to_string(cpu), ec)) {
+                auto name = entry.path().filename().string();
+                if (name.starts_with("node") && name.size() > 4) {
+                    numa_node = uint32_t(std::strtoul(name.c_str() + 4, nullptr, 10));
+                    break;
+                }
+            }
+            result.push_back({cpu, numa_node});
+        }
+    }
+#endif
+    std::stable_sort(result.begin(), result.end(), [](CpuInfo const &a, CpuInfo const &b) { return a.numa_node < b.numa_node; });
+    return result;
+}
+
+static void pin_thread(std::thread &thread, uint32_t cpu) {
+#if defined(_WIN32)
+    SetThreadAffinityMask(thread.native_handle(), DWORD_PTR{1} << cpu);
+#elif defined(__linux__)
+    auto cpu_set = cpu_set_t{};
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set), &cpu_set);
+#endif
+}
+
 static constexpr uint32_t EXTERNAL_THREAD_INDEX = std::numeric_limits<uint32_t>::max();
 
 struct ThreadPool {
   public:
-    ThreadPool(std::optional<uint32_t> thread_count = std::nullopt);
+    ThreadPool(thread_pool::Config const &config = {});
     ThreadPool(ThreadPool &&) = default;
     ThreadPool &operator=(ThreadPool &&) = default;
     ThreadPool(ThreadPool const &) = delete;
@@ -41,131 +267,472 @@ struct ThreadPool {
     void blocking_dispatch(std::shared_ptr<VirtualTask> task, TaskPriority priority = TaskPriority::LOW);
     void async_dispatch(std::shared_ptr<VirtualTask> task, TaskPriority priority = TaskPriority::LOW);
     void block_on(std::shared_ptr<VirtualTask> task);
+    void add_dependency(std::shared_ptr<VirtualTask> task, std::shared_ptr<VirtualTask> dependency);
+    auto cancel(std::shared_ptr<VirtualTask> task) -> bool;
+    auto get_worker_count() const -> uint32_t { return shared_data->worker_count; }
+    void set_stats_enabled(bool enabled);
+    auto get_stats() const -> thread_pool::Stats;
+    void reset_stats();
 
   private:
+    struct WorkerQueues {
+        WorkStealingDeque deques[TASK_PRIORITY_COUNT];
+        // The other workers, the ones on the same NUMA node first
+        std::vector<uint32_t> steal_order = {};
+    };
     struct SharedData {
-        // Signaled whenever there is work added to one of the work queues
+        std::unique_ptr<WorkerQueues[]> worker_queues = {};
+        uint32_t worker_count = {};
+
+        // Tasks dispatched from outside the pool, which can't push onto a worker's deque
+        std::mutex injected_mutex = {};
+        std::deque<QueuedTask *> injected_tasks[TASK_PRIORITY_COUNT] = {};
+        std::atomic_uint32_t injected_count[TASK_PRIORITY_COUNT] = {};
+
+        // Workers only sleep once every queue looked empty, see worker()
+        std::mutex sleep_mutex = {};
         std::condition_variable work_available = {};
-        // Signaled whenever a worker thread detects that it is finishing the last chunk of a task
-        std::condition_variable work_done = {};
+        std::atomic_uint32_t sleeping_count = {};
+        std::atomic_bool wake_pending = false;
+        std::atomic_bool kill = false;
+        // Threads asleep in block_on(), which wake up both when their task finishes and when new work is pushed
+        std::condition_variable waiter_wake = {};
+        std::atomic_uint32_t blocked_count = {};
+
+        // Only updated while stats_enabled is set. The last worker_stats entry is shared by all the
+        // threads outside the pool that help out in block_on().
+        std::atomic_bool stats_enabled = false;
+        std::unique_ptr<WorkerStatsCounters[]> worker_stats = {};
+        std::atomic_uint32_t tracked_task_count = {};
+        Histogram queue_latency = {};
+        Histogram run_latency = {};
+        Histogram queue_depth = {};
 
-        std::mutex threadpool_mutex = {};
-        std::deque<TaskChunk> high_priority_tasks = {};
-        std::deque<TaskChunk> low_priority_tasks = {};
-        bool kill = false;
+        auto get_stats(uint32_t thread_index) -> WorkerStatsCounters & {
+            return worker_stats[std::min(thread_index, worker_count)];
+        }
     };
     static void worker(std::shared_ptr<ThreadPool::SharedData> shared_data, uint32_t thread_id);
+    static void push_task(SharedData &shared_data, QueuedTask *queued_task);
+    static auto find_task(SharedData &shared_data, TaskPriority min_priority = TaskPriority::LOW) -> QueuedTask *;
+    static auto has_work(SharedData &shared_data, TaskPriority min_priority = TaskPriority::LOW) -> bool;
+    static void wake_worker(SharedData &shared_data);
+    static void run_task_chunk(SharedData &shared_data, QueuedTask *queued_task, uint32_t thread_index);
+    static void finish_chunk(SharedData &shared_data, VirtualTask &task);
+    static void release_task(SharedData &shared_data, std::shared_ptr<VirtualTask> task);
+    static void complete_task(SharedData &shared_data, VirtualTask &task);
+    static auto run_own_chunk(SharedData &shared_data, VirtualTask &task, uint32_t thread_index) -> bool;
+    static void execute_chunk(SharedData &shared_data, VirtualTask &task, uint32_t chunk_index, uint32_t thread_index);
     std::shared_ptr<SharedData> shared_data = {};
     std::vector<std::thread> worker_threads = {};
 };
 
-static ThreadPool s_instance = ThreadPool();
+// Lets dispatches from inside a task go straight to the worker's own deque
+static thread_local void const *tl_worker_pool = nullptr;
+static thread_local uint32_t tl_worker_index = EXTERNAL_THREAD_INDEX;
+
+static thread_pool::Config s_config = {};
+
+// Created on first use rather than at static init, so that it can be configured first
+static auto get_instance() -> ThreadPool & {
+    static auto instance = [] {
+        auto config = s_config;
+        if (auto const *worker_count = std::getenv("VOXEL_RASTER_THREADS"); worker_count != nullptr) {
+            config.worker_count = uint32_t(std::strtoul(worker_count, nullptr, 10));
+        }
+        return ThreadPool(config);
+    }();
+    return instance;
+}
 
 ThreadPool::~ThreadPool() {
+    if (!shared_data) {
+        return;
+    }
     {
-        std::unique_lock lock{shared_data->threadpool_mutex};
+        std::unique_lock lock{shared_data->sleep_mutex};
         shared_data->kill = true;
         shared_data->work_available.notify_all();
     }
     for (auto &worker : worker_threads) {
         worker.join();
     }
+    // Entries can outlive their tasks' last chunk when a waiter claimed the rest directly
+    for (uint32_t priority_index = 0; priority_index < TASK_PRIORITY_COUNT; ++priority_index) {
+        for (uint32_t i = 0; i < shared_data->worker_count; ++i) {
+            while (auto *queued_task = shared_data->worker_queues[i].deques[priority_index].steal()) {
+                delete queued_task;
+            }
+        }
+        for (auto *queued_task : shared_data->injected_tasks[priority_index]) {
+            delete queued_task;
+        }
+        shared_data->injected_tasks[priority_index].clear();
+    }
 }
 
-void ThreadPool::worker(std::shared_ptr<ThreadPool::SharedData> shared_data, uint32_t thread_index) {
-    std::unique_lock lock{shared_data->threadpool_mutex};
-    while (true) {
-        shared_data->work_available.wait(
-            lock, [&] { return !shared_data->high_priority_tasks.empty() || !shared_data->low_priority_tasks.empty() || shared_data->kill; });
-        if (shared_data->kill) {
-            return;
+void ThreadPool::push_task(SharedData &shared_data, QueuedTask *queued_task) {
+    auto priority_index = static_cast<uint32_t>(queued_task->priority);
+    if (tl_worker_pool == &shared_data) {
+        shared_data.worker_queues[tl_worker_index].deques[priority_index].push(queued_task);
+    } else {
+        std::lock_guard lock{shared_data.injected_mutex};
+        shared_data.injected_tasks[priority_index].push_back(queued_task);
+        shared_data.injected_count[priority_index].fetch_add(1, std::memory_order_relaxed);
+    }
+    // Pairs with the fences in worker() and block_on(), so that either the sleeper sees the new task or this sees the sleeper
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wake_worker(shared_data);
+    if (shared_data.blocked_count.load(std::memory_order_relaxed) != 0) {
+        std::lock_guard lock{shared_data.sleep_mutex};
+        shared_data.waiter_wake.notify_all();
+    }
+}
+
+// Wakes one sleeping worker, unless one is already on its way. Once that one finds work, it wakes the
+// next if there's more, so a burst of dispatches doesn't cost a notify each.
+void ThreadPool::wake_worker(SharedData &shared_data) {
+    if (shared_data.sleeping_count.load(std::memory_order_relaxed) == 0 || shared_data.wake_pending.exchange(true, std::memory_order_relaxed)) {
+        return;
+    }
+    std::lock_guard lock{shared_data.sleep_mutex};
+    // the sleeper may have woken up on its own in the meantime, and then nobody would reset wake_pending
+    if (shared_data.sleeping_count.load(std::memory_order_relaxed) == 0) {
+        shared_data.wake_pending.store(false, std::memory_order_relaxed);
+        return;
+    }
+    shared_data.work_available.notify_one();
+}
+
+// Only looks at work of min_priority and up
+auto ThreadPool::find_task(SharedData &shared_data, TaskPriority min_priority) -> QueuedTask * {
+    auto const is_worker = tl_worker_pool == &shared_data;
+    for (auto priority : {TaskPriority::HIGH, TaskPriority::LOW}) {
+        if (priority < min_priority) {
+            break;
         }
+        auto priority_index = static_cast<uint32_t>(priority);
+        if (is_worker) {
+            if (auto *queued_task = shared_data.worker_queues[tl_worker_index].deques[priority_index].pop(); queued_task != nullptr) {
+                return queued_task;
+            }
+        }
+        if (shared_data.injected_count[priority_index].load(std::memory_order_relaxed) != 0) {
+            std::lock_guard lock{shared_data.injected_mutex};
+            auto &injected_tasks = shared_data.injected_tasks[priority_index];
+            if (!injected_tasks.empty()) {
+                auto *queued_task = injected_tasks.front();
+                injected_tasks.pop_front();
+                shared_data.injected_count[priority_index].fetch_sub(1, std::memory_order_relaxed);
+                return queued_task;
+            }
+        }
+        auto steal = [&](uint32_t victim) {
+            auto *queued_task = shared_data.worker_queues[victim].deques[priority_index].steal();
+            if (queued_task != nullptr && shared_data.stats_enabled.load(std::memory_order_relaxed)) {
+                shared_data.get_stats(tl_worker_index).stolen_task_count.fetch_add(1, std::memory_order_relaxed);
+            }
+            return queued_task;
+        };
+        if (is_worker) {
+            for (auto victim : shared_data.worker_queues[tl_worker_index].steal_order) {
+                if (auto *queued_task = steal(victim); queued_task != nullptr) {
+                    return queued_task;
+                }
+            }
+        } else {
+            for (uint32_t victim = 0; victim < shared_data.worker_count; ++victim) {
+                if (auto *queued_task = steal(victim); queued_task != nullptr) {
+                    return queued_task;
+                }
+            }
+        }
+    }
+    return nullptr;
+}
+
+auto ThreadPool::has_work(SharedData &shared_data, TaskPriority min_priority) -> bool {
+    for (auto priority_index = static_cast<uint32_t>(min_priority); priority_index < TASK_PRIORITY_COUNT; ++priority_index) {
+        if (shared_data.injected_count[priority_index].load(std::memory_order_relaxed) != 0) {
+            return true;
+        }
+        for (uint32_t i = 0; i < shared_data.worker_count; ++i) {
+            if (!shared_data.worker_queues[i].deques[priority_index].maybe_empty()) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
 
-        bool const high_priority_work_available = !shared_data->high_priority_tasks.empty();
-        auto &selected_queue = high_priority_work_available ? shared_data->high_priority_tasks : shared_data->low_priority_tasks;
-        TaskChunk current_chunk = std::move(selected_queue.front());
-        selected_queue.pop_front();
-        current_chunk.task->started += 1;
-        lock.unlock();
+void ThreadPool::run_task_chunk(SharedData &shared_data, QueuedTask *queued_task, uint32_t thread_index) {
+    // finish_chunk() still touches the task after its waiters may have returned, so hold a reference
+    // even if someone else retires the entry in the meantime
+    auto keep_alive = std::shared_ptr<VirtualTask>{};
+    auto *task = queued_task->task.get();
+    auto chunk_index = claim_chunk(*task, queued_task->run_index);
+    if (chunk_index + 1 < task->chunk_count) {
+        keep_alive = queued_task->task;
+        push_task(shared_data, queued_task);
+    } else {
+        keep_alive = std::move(queued_task->task);
+        delete queued_task;
+    }
+    if (chunk_index < task->chunk_count) {
+        execute_chunk(shared_data, *task, chunk_index, thread_index);
+    }
+}
+
+void ThreadPool::execute_chunk(SharedData &shared_data, VirtualTask &task, uint32_t chunk_index, uint32_t thread_index) {
+    if (!shared_data.stats_enabled.load(std::memory_order_relaxed)) {
+        task.callback(chunk_index, thread_index);
+        finish_chunk(shared_data, task);
+        return;
+    }
+    auto const start_time = get_time_ns();
+    if (chunk_index == 0 && task.is_tracked) {
+        task.start_time = start_time;
+        shared_data.queue_latency.add(uint64_t(start_time - task.queued_time) / 1000);
+    }
+    task.callback(chunk_index, thread_index);
+    auto &stats = shared_data.get_stats(thread_index);
+    stats.executed_chunk_count.fetch_add(1, std::memory_order_relaxed);
+    stats.busy_time.fetch_add(get_time_ns() - start_time, std::memory_order_relaxed);
+    finish_chunk(shared_data, task);
+}
+
+void ThreadPool::finish_chunk(SharedData &shared_data, VirtualTask &task) {
+    if (task.not_finished.fetch_sub(1, std::memory_order_acq_rel) == 2) {
+        complete_task(shared_data, task);
+    }
+}
+
+// Queues the task once its dispatch and all of its dependencies are in
+void ThreadPool::release_task(SharedData &shared_data, std::shared_ptr<VirtualTask> task) {
+    if (task->pending_dependencies.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    task->is_tracked = shared_data.stats_enabled.load(std::memory_order_relaxed);
+    if (task->is_tracked) {
+        task->queued_time = get_time_ns();
+        task->start_time = task->queued_time;
+        shared_data.queue_depth.add(shared_data.tracked_task_count.fetch_add(1, std::memory_order_relaxed) + 1);
+    }
+    if (task->chunk_count == 0) {
+        complete_task(shared_data, *task);
+    } else {
+        auto priority = task->priority;
+        auto run_index = get_run_index(*task);
+        push_task(shared_data, new QueuedTask{std::move(task), priority, run_index});
+    }
+}
+
+// Runs after the last chunk. The continuations are taken before the final decrement, because a waiter may
+// already be setting up the task's next run once it sees not_finished reach 0.
+void ThreadPool::complete_task(SharedData &shared_data, VirtualTask &task) {
+    auto continuations = std::vector<std::shared_ptr<VirtualTask>>{};
+    // Dependencies are only added before the task is dispatched, so this doesn't race with add_dependency()
+    if (!task.continuations.empty()) {
+        std::lock_guard lock{task.continuations_mutex};
+        continuations.swap(task.continuations);
+    }
+    task.pending_dependencies.store(1, std::memory_order_relaxed);
+    if (task.is_tracked) {
+        shared_data.run_latency.add(uint64_t(get_time_ns() - task.start_time) / 1000);
+        shared_data.tracked_task_count.fetch_sub(1, std::memory_order_relaxed);
+        task.is_tracked = false;
+    }
+    // Both this and the waiter_count increment in block_on() are seq_cst, so either the waiter sees
+    // the task finished or this sees the waiter
+    task.not_finished.fetch_sub(1, std::memory_order_seq_cst);
+    if (task.waiter_count.load(std::memory_order_seq_cst) != 0) {
+        std::lock_guard lock{shared_data.sleep_mutex};
+        shared_data.waiter_wake.notify_all();
+    }
+    for (auto &continuation : continuations) {
+        release_task(shared_data, std::move(continuation));
+    }
+}
+
+// Claims and runs the next chunk of a specific task, without going through the queues
+auto ThreadPool::run_own_chunk(SharedData &shared_data, VirtualTask &task, uint32_t thread_index) -> bool {
+    if (task.pending_dependencies.load(std::memory_order_acquire) != 0) {
+        return false;
+    }
+    auto chunk_index = claim_chunk(task, get_run_index(task));
+    if (chunk_index >= task.chunk_count) {
+        return false;
+    }
+    execute_chunk(shared_data, task, chunk_index, thread_index);
+    return true;
+}
 
-        current_chunk.task->callback(current_chunk.chunk_index, thread_index);
+void ThreadPool::worker(std::shared_ptr<ThreadPool::SharedData> shared_data, uint32_t thread_index) {
+    tl_worker_pool = shared_data.get();
+    tl_worker_index = thread_index;
+    auto woken = false;
+    while (!shared_data->kill.load(std::memory_order_relaxed)) {
+        if (auto *queued_task = find_task(*shared_data); queued_task != nullptr) {
+            if (woken) {
+                woken = false;
+                if (has_work(*shared_data)) {
+                    wake_worker(*shared_data);
+                }
+            }
+            run_task_chunk(*shared_data, queued_task, thread_index);
+            continue;
+        }
 
-        lock.lock();
-        current_chunk.task->not_finished -= 1;
-        // Working on last chunk of a task, notify in case there is a thread waiting for this task to be done
-        if (current_chunk.task->not_finished == 0) {
-            shared_data->work_done.notify_all();
+        auto const sleep_start_time = shared_data->stats_enabled.load(std::memory_order_relaxed) ? get_time_ns() : int64_t{};
+        std::unique_lock lock{shared_data->sleep_mutex};
+        shared_data->sleeping_count.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        shared_data->work_available.wait(lock, [&] {
+            // A notify can arrive after the work it was for has already been taken, so every check
+            // under the lock has to clear wake_pending, not just the one that ends the wait
+            shared_data->wake_pending.store(false, std::memory_order_relaxed);
+            return has_work(*shared_data) || shared_data->kill;
+        });
+        shared_data->sleeping_count.fetch_sub(1, std::memory_order_relaxed);
+        woken = true;
+        if (sleep_start_time != 0) {
+            shared_data->get_stats(thread_index).idle_time.fetch_add(get_time_ns() - sleep_start_time, std::memory_order_relaxed);
         }
     }
 }
 
-ThreadPool::ThreadPool(std::optional<uint32_t> thread_count) {
-    uint32_t const real_thread_count = thread_count.value_or(std::thread::hardware_concurrency());
+ThreadPool::ThreadPool(thread_pool::Config const &config) {
+    auto cpus = config.pin_workers ? get_available_cpus() : std::vector<CpuInfo>{};
+    auto const hardware_thread_count = cpus.empty() ? std::max(std::thread::hardware_concurrency(), 1u) : uint32_t(cpus.size());
+    auto const reserved_thread_count = std::min(config.reserved_thread_count, hardware_thread_count - 1);
+    cpus.erase(cpus.begin(), cpus.begin() + std::min(size_t(reserved_thread_count), cpus.size()));
+    uint32_t const real_thread_count = config.worker_count != 0 ? config.worker_count : hardware_thread_count - reserved_thread_count;
+
     shared_data = std::make_shared<SharedData>();
+    shared_data->worker_queues = std::make_unique<WorkerQueues[]>(real_thread_count);
+    shared_data->worker_count = real_thread_count;
+    shared_data->worker_stats = std::make_unique<WorkerStatsCounters[]>(real_thread_count + 1);
+    shared_data->stats_enabled = config.collect_stats;
+    // Without pinning the workers move between nodes anyway, so they are all treated as being on the same one
+    auto get_numa_node = [&](uint32_t thread_index) { return cpus.empty() ? 0u : cpus[thread_index % cpus.size()].numa_node; };
+    for (uint32_t thread_index = 0; thread_index < real_thread_count; thread_index++) {
+        auto &steal_order = shared_data->worker_queues[thread_index].steal_order;
+        for (uint32_t i = 1; i < real_thread_count; ++i) {
+            steal_order.push_back((thread_index + i) % real_thread_count);
+        }
+        std::stable_partition(steal_order.begin(), steal_order.end(), [&](uint32_t victim) { return get_numa_node(victim) == get_numa_node(thread_index); });
+    }
     for (uint32_t thread_index = 0; thread_index < real_thread_count; thread_index++) {
         worker_threads.push_back({
             std::thread([=, this]() { ThreadPool::worker(shared_data, thread_index); }),
         });
+        if (!cpus.empty()) {
+            pin_thread(worker_threads.back(), cpus[thread_index % cpus.size()].cpu);
+        }
     }
 }
 
 void ThreadPool::blocking_dispatch(std::shared_ptr<VirtualTask> task, TaskPriority priority) {
-    // Don't need mutex here as no thread is working on this task yet
-    task->not_finished = task->chunk_count;
-    auto &selected_queue = priority == TaskPriority::HIGH ? shared_data->high_priority_tasks : shared_data->low_priority_tasks;
+    async_dispatch(task, priority);
+    block_on(task);
+}
 
-    // chunk_index 0 will be worked on by this thread
-    std::unique_lock lock{shared_data->threadpool_mutex};
+void ThreadPool::async_dispatch(std::shared_ptr<VirtualTask> task, TaskPriority priority) {
+    task->priority = priority;
+    task->not_finished.store(task->chunk_count + 1, std::memory_order_relaxed);
+    task->next_chunk.store(uint64_t(get_run_index(*task) + 1) << 32, std::memory_order_relaxed);
+    release_task(*shared_data, std::move(task));
+}
 
-    for (uint32_t chunk_index = 1; chunk_index < task->chunk_count; chunk_index++) {
-        selected_queue.push_back({task, chunk_index});
+// Instead of idling until the task is done, the waiting thread runs the task's own chunks and then any
+// other queued work. That also keeps a worker waiting on a task from starving the pool of the thread
+// that would have run it. Threads outside the pool only take work of the task's own priority and up, so
+// that the main thread waiting on a HIGH parallel_for doesn't end up running a long LOW task.
+void ThreadPool::block_on(std::shared_ptr<VirtualTask> task) {
+    auto const thread_index = tl_worker_pool == shared_data.get() ? tl_worker_index : EXTERNAL_THREAD_INDEX;
+    auto const min_priority = thread_index == EXTERNAL_THREAD_INDEX ? task->priority : TaskPriority::LOW;
+    while (task->not_finished.load(std::memory_order_acquire) != 0) {
+        if (run_own_chunk(*shared_data, *task, thread_index)) {
+            continue;
+        }
+        if (auto *queued_task = find_task(*shared_data, min_priority); queued_task != nullptr) {
+            run_task_chunk(*shared_data, queued_task, thread_index);
+            continue;
+        }
+        // Nothing to help with right now. The task's chunks are either running elsewhere or still held back
+        // by dependencies, so sleep until it's done or until more work turns up, which may be exactly what
+        // it's waiting on.
+        std::unique_lock lock{shared_data->sleep_mutex};
+        task->waiter_count.fetch_add(1, std::memory_order_seq_cst);
+        shared_data->blocked_count.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        shared_data->waiter_wake.wait(lock, [&] {
+            return task->not_finished.load(std::memory_order_seq_cst) == 0 || has_work(*shared_data, min_priority);
+        });
+        shared_data->blocked_count.fetch_sub(1, std::memory_order_relaxed);
+        task->waiter_count.fetch_sub(1, std::memory_order_relaxed);
     }
+}
 
-    shared_data->work_available.notify_all();
-    // Contribute to finishing this task from this thread
-    uint32_t current_chunk_index = 0;
-    bool worked_on_last_chunk = false;
-    while (current_chunk_index != NO_MORE_CHUNKS_CODE) {
-        task->started += 1;
-
-        lock.unlock();
-        task->callback(current_chunk_index, EXTERNAL_THREAD_INDEX);
-        lock.lock();
-
-        task->not_finished -= 1;
-        bool more_chunks_in_queue = (task->started != task->chunk_count);
-        if (more_chunks_in_queue) {
-            current_chunk_index = selected_queue.front().chunk_index;
-            selected_queue.pop_front();
-        } else {
-            current_chunk_index = NO_MORE_CHUNKS_CODE;
+// Claims every chunk that hasn't started yet and counts it as finished, so that the queue entry finds
+// nothing left to run. Tasks that are still held back by dependencies aren't touched.
+auto ThreadPool::cancel(std::shared_ptr<VirtualTask> task) -> bool {
+    if (task->pending_dependencies.load(std::memory_order_acquire) != 0) {
+        return false;
+    }
+    auto next = task->next_chunk.load(std::memory_order_relaxed);
+    do {
+        if (uint32_t(next) >= task->chunk_count) {
+            return false;
         }
-
-        worked_on_last_chunk = (task->not_finished == 0);
+    } while (!task->next_chunk.compare_exchange_weak(next, (next & ~uint64_t{0xffffffff}) | task->chunk_count, std::memory_order_relaxed));
+    auto const first_skipped = uint32_t(next);
+    auto const skipped_count = task->chunk_count - first_skipped;
+    if (task->not_finished.fetch_sub(skipped_count, std::memory_order_acq_rel) == skipped_count + 1) {
+        complete_task(*shared_data, *task);
     }
+    return true;
+}
 
-    if (!worked_on_last_chunk) {
-        // This thread was not the last one working on this task, therefore we wait here to be notified once
-        // the last worker thread processing this task is done
-        shared_data->work_done.wait(lock, [&] { return task->not_finished == 0; });
-    }
+void ThreadPool::add_dependency(std::shared_ptr<VirtualTask> task, std::shared_ptr<VirtualTask> dependency) {
+    task->pending_dependencies.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard lock{dependency->continuations_mutex};
+    dependency->continuations.push_back(std::move(task));
 }
 
-void ThreadPool::async_dispatch(std::shared_ptr<VirtualTask> task, TaskPriority priority) {
-    task->not_finished = task->chunk_count;
-    auto &selected_queue = priority == TaskPriority::HIGH ? shared_data->high_priority_tasks : shared_data->low_priority_tasks;
-    {
-        std::lock_guard lock(shared_data->threadpool_mutex);
-        for (uint32_t chunk_index = 0; chunk_index < task->chunk_count; chunk_index++) {
-            selected_queue.push_back({task, chunk_index});
-        }
+void ThreadPool::set_stats_enabled(bool enabled) {
+    shared_data->stats_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+auto ThreadPool::get_stats() const -> thread_pool::Stats {
+    auto result = thread_pool::Stats{};
+    result.workers.resize(shared_data->worker_count + 1);
+    for (uint32_t i = 0; i < shared_data->worker_count + 1; ++i) {
+        auto const &counters = shared_data->worker_stats[i];
+        result.workers[i] = {
+            .executed_chunk_count = counters.executed_chunk_count.load(std::memory_order_relaxed),
+            .stolen_task_count = counters.stolen_task_count.load(std::memory_order_relaxed),
+            .busy_seconds = double(counters.busy_time.load(std::memory_order_relaxed)) * 1e-9,
+            .idle_seconds = double(counters.idle_time.load(std::memory_order_relaxed)) * 1e-9,
+        };
     }
-    shared_data->work_available.notify_all();
+    shared_data->queue_latency.read(result.queue_latency);
+    shared_data->run_latency.read(result.run_latency);
+    shared_data->queue_depth.read(result.queue_depth);
+    return result;
 }
 
-void ThreadPool::block_on(std::shared_ptr<VirtualTask> task) {
-    std::unique_lock lock{shared_data->threadpool_mutex};
-    shared_data->work_done.wait(lock, [&] { return task->not_finished == 0; });
+void ThreadPool::reset_stats() {
+    for (uint32_t i = 0; i < shared_data->worker_count + 1; ++i) {
+        auto &counters = shared_data->worker_stats[i];
+        counters.executed_chunk_count.store(0, std::memory_order_relaxed);
+        counters.stolen_task_count.store(0, std::memory_order_relaxed);
+        counters.busy_time.store(0, std::memory_order_relaxed);
+        counters.idle_time.store(0, std::memory_order_relaxed);
+    }
+    shared_data->queue_latency.reset();
+    shared_data->run_latency.reset();
+    shared_data->queue_depth.reset();
 }
 
 struct SimpleTask : VirtualTask {
@@ -180,6 +747,29 @@ struct SimpleTask : VirtualTask {
     }
 };
 
+struct BatchTask : VirtualTask {
+    thread_pool::BatchFunc *func;
+    void *user_ptr;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t grain;
+    BatchTask(thread_pool::BatchFunc *func, void *user_ptr, uint32_t begin, uint32_t end, uint32_t grain) : func{func}, user_ptr{user_ptr}, begin{begin}, end{end}, grain{std::max(grain, 1u)} {
+        chunk_count = (end - begin + this->grain - 1) / this->grain;
+    }
+
+    virtual void callback(uint32_t chunk_index, uint32_t thread_index) override {
+        auto const chunk_begin = begin + chunk_index * grain;
+        auto const chunk_end = std::min(chunk_begin + grain, end);
+        for (uint32_t index = chunk_begin; index < chunk_end; ++index) {
+            func(user_ptr, index);
+        }
+    }
+};
+
+struct GroupTask : VirtualTask {
+    virtual void callback(uint32_t chunk_index, uint32_t thread_index) override {}
+};
+
 struct thread_pool::TaskState {
     std::shared_ptr<VirtualTask> task;
 };
@@ -188,13 +778,82 @@ thread_pool::Task thread_pool::create_task(Func *func, void *user_ptr) {
     auto *result = new TaskState{std::make_shared<SimpleTask>(func, user_ptr)};
     return result;
 }
+thread_pool::Task thread_pool::create_batch_task(BatchFunc *func, void *user_ptr, uint32_t count, uint32_t grain) {
+    auto *result = new TaskState{std::make_shared<BatchTask>(func, user_ptr, 0, count, grain)};
+    return result;
+}
+thread_pool::Task thread_pool::create_group() {
+    auto *result = new TaskState{std::make_shared<GroupTask>()};
+    return result;
+}
 void thread_pool::destroy_task(Task task) {
     delete task;
 }
 
-void thread_pool::async_dispatch(Task task) {
-    s_instance.async_dispatch(task->task);
+void thread_pool::async_dispatch(Task task, TaskPriority priority) {
+    get_instance().async_dispatch(task->task, priority);
 }
 void thread_pool::wait(Task task) {
-    s_instance.block_on(task->task);
+    get_instance().block_on(task->task);
+}
+void thread_pool::add_dependency(Task task, Task dependency) {
+    get_instance().add_dependency(task->task, dependency->task);
+}
+auto thread_pool::cancel(Task task) -> bool {
+    return get_instance().cancel(task->task);
+}
+
+void thread_pool::configure(Config const &config) {
+    s_config = config;
+}
+auto thread_pool::get_worker_count() -> uint32_t {
+    return get_instance().get_worker_count();
+}
+
+void thread_pool::set_stats_enabled(bool enabled) {
+    get_instance().set_stats_enabled(enabled);
+}
+auto thread_pool::get_stats() -> Stats {
+    return get_instance().get_stats();
+}
+void thread_pool::reset_stats() {
+    get_instance().reset_stats();
+}
+
+// Prints the histograms as "<bucket start>: <count>", skipping the empty buckets at either end
+static auto format_histogram(uint64_t const *buckets, char const *unit) -> std::string {
+    auto first = uint32_t{0};
+    auto last = thread_pool::Stats::HISTOGRAM_BUCKET_COUNT;
+    while (first < last && buckets[first] == 0) {
+        ++first;
+    }
+    while (last > first && buckets[last - 1] == 0) {
+        --last;
+    }
+    auto result = std::string{};
+    for (uint32_t bucket_i = first; bucket_i < last; ++bucket_i) {
+        result += fmt::format("{}{}{}: {}", bucket_i == first ? "" : ", ", bucket_i == 0 ? 0 : 1ull << bucket_i, unit, buckets[bucket_i]);
+    }
+    return result;
+}
+
+void thread_pool::log_stats() {
+    auto stats = get_stats();
+    for (uint32_t i = 0; i < stats.workers.size(); ++i) {
+        auto const &worker = stats.workers[i];
+        auto name = i + 1 == stats.workers.size() ? std::string{"external"} : fmt::format("worker {}", i);
+        debug_utils::add_log(g_console, fmt::format("{}: {} chunks, {} steals, {:.3f} s busy, {:.3f} s idle",
+                                                    name, worker.executed_chunk_count, worker.stolen_task_count, worker.busy_seconds, worker.idle_seconds)
+                                            .c_str());
+    }
+    debug_utils::add_log(g_console, fmt::format("queue latency: {}", format_histogram(stats.queue_latency, "us")).c_str());
+    debug_utils::add_log(g_console, fmt::format("run latency: {}", format_histogram(stats.run_latency, "us")).c_str());
+    debug_utils::add_log(g_console, fmt::format("queue depth: {}", format_histogram(stats.queue_depth, "")).c_str());
+}
+
+void thread_pool::parallel_for(uint32_t begin, uint32_t end, uint32_t grain, BatchFunc *func, void *user_ptr, TaskPriority priority) {
+    if (begin >= end) {
+        return;
+    }
+    get_instance().blocking_dispatch(std::make_shared<BatchTask>(func, user_ptr, begin, end, grain), priority);
 }
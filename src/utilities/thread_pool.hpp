@@ -1,13 +1,86 @@
 #pragma once
 
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
 namespace thread_pool {
     struct TaskState;
     using Task = TaskState *;
 
+    // Workers always take HIGH tasks first. A running LOW chunk isn't interrupted, so HIGH work waits for at most one chunk per worker.
+    enum struct TaskPriority {
+        LOW,
+        HIGH,
+    };
+
+    struct Config {
+        // 0 means one worker per hardware thread that isn't reserved
+        uint32_t worker_count = 0;
+        // Hardware threads left to the main/render thread. When pinning, the workers stay off the first ones.
+        uint32_t reserved_thread_count = 0;
+        // Pins every worker to one CPU, and has workers steal from others on the same NUMA node first
+        bool pin_workers = false;
+        bool collect_stats = false;
+    };
+    // The pool is created on first use, so this only has an effect before then. The VOXEL_RASTER_THREADS
+    // environment variable overrides worker_count.
+    void configure(Config const &config);
+    auto get_worker_count() -> uint32_t;
+
     using Func = void(void *);
     Task create_task(Func *func, void *user_ptr);
     void destroy_task(Task task);
 
-    void async_dispatch(Task task);
+    // A single task that calls func for every index in [0, count), handed out to the workers
+    // grain indices at a time. Dispatching it costs one allocation and one wake-up.
+    using BatchFunc = void(void *user_ptr, uint32_t index);
+    Task create_batch_task(BatchFunc *func, void *user_ptr, uint32_t count, uint32_t grain = 1);
+
+    // A task with no work of its own, for waiting on several tasks at once or joining them before a continuation
+    Task create_group();
+
+    void async_dispatch(Task task, TaskPriority priority = TaskPriority::LOW);
     void wait(Task task);
+    // Skips every chunk of a dispatched task that hasn't started yet, after which the task counts as finished,
+    // and its continuations are released as usual. Returns false if there was nothing left to skip, or if the
+    // task is still waiting on dependencies.
+    auto cancel(Task task) -> bool;
+
+    // Holds back the next run of task until dependency has finished, without blocking any thread. Both have to
+    // be set up before either is dispatched, and task still has to be dispatched itself.
+    void add_dependency(Task task, Task dependency);
+
+    // Calls func for every index in [begin, end) and returns once they're all done. The calling thread helps.
+    void parallel_for(uint32_t begin, uint32_t end, uint32_t grain, BatchFunc *func, void *user_ptr, TaskPriority priority = TaskPriority::LOW);
+    template <typename F>
+    void parallel_for(uint32_t begin, uint32_t end, uint32_t grain, F &&func, TaskPriority priority = TaskPriority::LOW) {
+        parallel_for(
+            begin, end, grain, [](void *user_ptr, uint32_t index) { (*static_cast<std::remove_reference_t<F> *>(user_ptr))(index); }, (void *)&func, priority);
+    }
+
+    struct WorkerStats {
+        uint64_t executed_chunk_count;
+        uint64_t stolen_task_count;
+        // Time spent in task callbacks, and time spent asleep waiting for work
+        double busy_seconds;
+        double idle_seconds;
+    };
+    struct Stats {
+        static constexpr uint32_t HISTOGRAM_BUCKET_COUNT = 24;
+        // One per worker, plus a last one for all the threads outside the pool that help out in wait()
+        std::vector<WorkerStats> workers;
+        // Bucket i counts the values in [2^i, 2^(i+1)), with bucket 0 starting at 0 instead.
+        // The latencies are in microseconds, from queueing to the first chunk starting and from there to the last one finishing.
+        uint64_t queue_latency[HISTOGRAM_BUCKET_COUNT];
+        uint64_t run_latency[HISTOGRAM_BUCKET_COUNT];
+        // Number of queued or running tasks, sampled whenever a task is queued
+        uint64_t queue_depth[HISTOGRAM_BUCKET_COUNT];
+    };
+    // Collecting stats costs a couple of clock reads per chunk, so it's off unless enabled here or in the Config
+    void set_stats_enabled(bool enabled);
+    auto get_stats() -> Stats;
+    void reset_stats();
+    // Dumps get_stats() to the console
+    void log_stats();
 } // namespace thread_pool
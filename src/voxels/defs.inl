@@ -11,6 +11,9 @@
 #define VOXEL_BRICK_SIZE_LOG2 3
 #define VOXEL_BRICK_SIZE (1 << VOXEL_BRICK_SIZE_LOG2)
 #define VOXELS_PER_BRICK (VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE)
+// The densities of a brick plus a one voxel border, so that normals can be taken by central differences
+#define DENSITY_TILE_SIZE (VOXEL_BRICK_SIZE + 2)
+#define VOXELS_PER_DENSITY_TILE (DENSITY_TILE_SIZE * DENSITY_TILE_SIZE * DENSITY_TILE_SIZE)
 #define MAX_INNER_FACES_PER_BRICK ((VOXEL_BRICK_SIZE - 1) * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE * 3)
 #define MAX_OUTER_FACES_PER_BRICK ((VOXEL_BRICK_SIZE + 1) * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE * 3)
 #define MAX_MESHLETS_PER_BRICK ((MAX_OUTER_FACES_PER_BRICK + MAX_TRIANGLES_PER_MESHLET - 1) / MAX_TRIANGLES_PER_MESHLET)
@@ -55,3 +58,37 @@ struct NoiseSettings {
     float amplitude;
     int octaves;
 };
+
+// Generator programs are node graphs flattened into post-order, evaluated on a small stack. Every
+// op has both a value and an interval evaluator. The params of each op are listed next to it.
+#define GENERATOR_MAX_NODE_COUNT 32
+#define GENERATOR_MAX_STACK_SIZE 8
+#define GENERATOR_MAX_DOMAIN_DEPTH 4
+
+#define GENERATOR_OP_CONSTANT 0      // value
+#define GENERATOR_OP_PLANE 1         // normal.xyz, offset: dot(normal, p) - offset
+#define GENERATOR_OP_SPHERE 2        // center.xyz, radius
+#define GENERATOR_OP_OCTAVES 3       // persistence, lacunarity, scale, amplitude, and octave_count
+#define GENERATOR_OP_ADD 4           // pops b, a, pushes a + b
+#define GENERATOR_OP_MULTIPLY 5      // pops b, a, pushes a * b
+#define GENERATOR_OP_UNION 6         // pops b, a, pushes min(a, b)
+#define GENERATOR_OP_INTERSECTION 7  // pops b, a, pushes max(a, b)
+#define GENERATOR_OP_DIFFERENCE 8    // pops b, a, pushes max(a, -b)
+#define GENERATOR_OP_PUSH_ROTATION 9 // 3x3 column-major matrix, applied to the domain until the matching pop
+#define GENERATOR_OP_POP_DOMAIN 10
+
+struct GeneratorNode {
+    int op;
+    int octave_count;
+    float params[9];
+};
+
+// Programs that are just a plane plus up to this many octaves get kernels specialized for their octave count
+#define GENERATOR_MAX_SPECIALIZED_OCTAVES 8
+
+struct GeneratorProgram {
+    int node_count;
+    // The octave count of plane plus octaves programs, which selects their specialized kernels. 0 otherwise.
+    int terrain_octave_count;
+    GeneratorNode nodes[GENERATOR_MAX_NODE_COUNT];
+};
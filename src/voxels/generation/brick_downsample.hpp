@@ -0,0 +1,43 @@
+#pragma once
+
+#include <voxels/defs.inl>
+
+#include <bit>
+#include <cstdint>
+
+#include "brick_faces.hpp"
+
+// 2x2x2 reduction of brick bitmasks, for building a chunk out of the 8 chunks of the next finer level.
+// Each brick of the coarser level covers 2x2x2 bricks of the finer one, and every finer brick fills
+// one 4x4x4 octant of it.
+
+// The 2x2 block of voxels at (x * 2, y * 2) in a layer from get_brick_layer_z
+static inline auto get_downsample_block_mask(int xi, int yi) -> uint64_t {
+    return 0x0303ull << (xi * 2 + yi * 2 * VOXEL_BRICK_SIZE);
+}
+
+// Sets the bits of octant `octant_i` of dst from the 8^3 voxels of src. A coarse voxel is solid once
+// `min_solid_count` of its 8 voxels are. dst has to be cleared beforehand.
+static inline void downsample_brick_octant(uint32_t dst_bits[], int octant_i, uint32_t const src_bits[], int min_solid_count) {
+    constexpr auto HALF_SIZE = VOXEL_BRICK_SIZE / 2;
+    auto octant_x = (octant_i & 1) * HALF_SIZE;
+    auto octant_y = ((octant_i >> 1) & 1) * HALF_SIZE;
+    auto octant_z = (octant_i >> 2) * HALF_SIZE;
+    for (int zi = 0; zi < HALF_SIZE; ++zi) {
+        auto layer_a = get_brick_layer_z(src_bits, zi * 2 + 0);
+        auto layer_b = get_brick_layer_z(src_bits, zi * 2 + 1);
+        if ((layer_a | layer_b) == 0) {
+            continue;
+        }
+        for (int yi = 0; yi < HALF_SIZE; ++yi) {
+            for (int xi = 0; xi < HALF_SIZE; ++xi) {
+                auto mask = get_downsample_block_mask(xi, yi);
+                auto solid_count = std::popcount(layer_a & mask) + std::popcount(layer_b & mask);
+                if (solid_count >= min_solid_count) {
+                    auto voxel_index = (octant_x + xi) + (octant_y + yi) * VOXEL_BRICK_SIZE + (octant_z + zi) * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE;
+                    dst_bits[voxel_index / 32] |= 1u << (voxel_index % 32);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <voxels/defs.inl>
+
+#include <cstdint>
+
+// Word-parallel extraction of brick faces. With 8^3 bricks, every z layer of a brick bitmask
+// is one 64-bit word (x in the low bits of each byte, y selecting the byte), so a face can be
+// pulled out with a handful of shifts and masks instead of one call per voxel.
+static_assert(VOXEL_BRICK_SIZE == 8);
+
+static inline auto get_brick_layer_z(uint32_t const bits[], int zi) -> uint64_t {
+    return uint64_t(bits[zi * 2 + 0]) | (uint64_t(bits[zi * 2 + 1]) << 32);
+}
+
+// Returns the 8x8 plane of voxels at `layer` along `axis` (0 = x, 1 = y, 2 = z), laid out like one
+// face of VoxelBrickBitmask::neighbor_bits: bit (a + b * 8), where (a, b) are the two remaining axes in order.
+static inline auto extract_brick_face(uint32_t const bits[], int axis, int layer) -> uint64_t {
+    if (axis == 2) {
+        return get_brick_layer_z(bits, layer);
+    }
+    auto result = uint64_t{};
+    for (int zi = 0; zi < VOXEL_BRICK_SIZE; ++zi) {
+        auto layer_z = get_brick_layer_z(bits, zi);
+        auto row = uint64_t{};
+        if (axis == 1) {
+            row = (layer_z >> (layer * 8)) & 0xff;
+        } else {
+            // gather bit `layer` of each byte into a single byte
+            row = (((layer_z >> layer) & 0x0101010101010101ull) * 0x0102040810204080ull) >> 56;
+        }
+        result |= row << (zi * 8);
+    }
+    return result;
+}
+
+// Fills the six faces of neighbor_bits from the facing layers of the neighboring bricks, in the order
+// -x, -y, -z, +x, +y, +z. A null neighbor is treated as solid.
+static inline void generate_neighbor_bits(uint32_t neighbor_bits[], uint32_t const *const neighbor_brick_bits[6]) {
+    for (int fi = 0; fi < 6; ++fi) {
+        auto axis = fi % 3;
+        auto layer = fi < 3 ? VOXEL_BRICK_SIZE - 1 : 0;
+        auto face = neighbor_brick_bits[fi] != nullptr ? extract_brick_face(neighbor_brick_bits[fi], axis, layer) : ~uint64_t{0};
+        neighbor_bits[fi * 2 + 0] = uint32_t(face);
+        neighbor_bits[fi * 2 + 1] = uint32_t(face >> 32);
+    }
+}
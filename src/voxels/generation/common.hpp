@@ -308,6 +308,45 @@ static inline DensityNrm noise(RandomCtx random_ctx, vec3 x, float scale, float
     return result;
 }
 
+// Same value as noise(), without the derivative. Used where only the sign of the density matters.
+static inline float noise_density(RandomCtx random_ctx, vec3 x, float scale, float amp) {
+    x = x * scale;
+
+    ivec3 p = floor(x);
+    vec3 w = fract(x);
+    vec3 u = w * w * (3.0f - 2.0f * w);
+
+    const ivec3 offset_a = {0, 0, 0};
+    const ivec3 offset_b = {1, 0, 0};
+    const ivec3 offset_c = {0, 1, 0};
+    const ivec3 offset_d = {1, 1, 0};
+    const ivec3 offset_e = {0, 0, 1};
+    const ivec3 offset_f = {1, 0, 1};
+    const ivec3 offset_g = {0, 1, 1};
+    const ivec3 offset_h = {1, 1, 1};
+
+    float a = fast_random(random_ctx, p + offset_a);
+    float b = fast_random(random_ctx, p + offset_b);
+    float c = fast_random(random_ctx, p + offset_c);
+    float d = fast_random(random_ctx, p + offset_d);
+    float e = fast_random(random_ctx, p + offset_e);
+    float f = fast_random(random_ctx, p + offset_f);
+    float g = fast_random(random_ctx, p + offset_g);
+    float h = fast_random(random_ctx, p + offset_h);
+
+    float k0 = a;
+    float k1 = b - a;
+    float k2 = c - a;
+    float k3 = e - a;
+    float k4 = a - b - c + d;
+    float k5 = a - c - e + g;
+    float k6 = a - b - e + f;
+    float k7 = -a + b + c - d + e - f - g + h;
+
+    float result_val = k0 + k1 * u.x + k2 * u.y + k3 * u.z + k4 * u.x * u.y + k5 * u.y * u.z + k6 * u.z * u.x + k7 * u.x * u.y * u.z;
+    return (result_val * 2.0f - 1.0f) * amp;
+}
+
 static inline MinMax minmax_noise_in_region(RandomCtx random_ctx, vec3 region_center, vec3 region_size, float scale, float amp) {
     // Use the lipschitz constant to compute min/max est. For the cubic interpolation
     // function of this noise function, said constant is 2.0 * 1.5 * scale * amp.
@@ -325,23 +364,6 @@ static inline MinMax minmax_noise_in_region(RandomCtx random_ctx, vec3 region_ce
     return result;
 }
 
-static inline DensityNrm gradient_z(vec3 p, float slope, float offset) {
-    DensityNrm result;
-    result.val = (p.z - offset) * slope;
-    vec3 nrm = {0, 0, slope};
-    result.nrm = nrm;
-    return result;
-}
-static inline MinMax minmax_gradient_z(vec3 p0, vec3 p1, float slope, float offset) {
-    MinMax temp;
-    temp.min = (p0.z - offset) * slope;
-    temp.max = (p1.z - offset) * slope;
-    MinMax result;
-    result.min = min(temp.min, temp.max);
-    result.max = max(temp.min, temp.max);
-    return result;
-}
-
 #if defined(__cplusplus)
 #define MAT3_INIT(a, b, c, d, e, f, g, h, i) \
     { a, b, c, d, e, f, g, h, i }
@@ -355,54 +377,207 @@ static inline MinMax minmax_gradient_z(vec3 p0, vec3 p1, float slope, float offs
 const uniform mat3 m = MAT3_INIT(+0.0f, +0.80f, +0.60f,
                                  -0.8f, +0.36f, -0.48f,
                                  -0.6f, -0.48f, +0.64f);
-const uniform mat3 mi = MAT3_INIT(+0.0f, -0.80f, -0.60f,
-                                  +0.8f, +0.36f, -0.48f,
-                                  +0.6f, -0.48f, +0.64f);
+static inline vec3 generator_rotate(uniform float const matrix[], vec3 v) {
+    vec3 result;
+    result.x = matrix[0] * v.x + matrix[3] * v.y + matrix[6] * v.z;
+    result.y = matrix[1] * v.x + matrix[4] * v.y + matrix[7] * v.z;
+    result.z = matrix[2] * v.x + matrix[5] * v.y + matrix[8] * v.z;
+    return result;
+}
+// Half extents of the axis aligned box around a rotated box
+static inline vec3 generator_rotate_extent(uniform float const matrix[], vec3 v) {
+    vec3 result;
+    result.x = abs(matrix[0]) * v.x + abs(matrix[3]) * v.y + abs(matrix[6]) * v.z;
+    result.y = abs(matrix[1]) * v.x + abs(matrix[4]) * v.y + abs(matrix[7]) * v.z;
+    result.z = abs(matrix[2]) * v.x + abs(matrix[5]) * v.y + abs(matrix[8]) * v.z;
+    return result;
+}
 
-static inline DensityNrm voxel_value(RandomCtx random_ctx, uniform NoiseSettings const *uniform noise_settings, vec3 pos) {
-    DensityNrm result;
-    // pos = fract(pos / 4.0f) * 4.0f - 2.0f;
-    // result.val = length(pos) - 2.0f;
-    // result.nrm = normalize(pos);
-    uniform mat3 inv = MAT3_INIT(1, 0, 0, 0, 1, 0, 0, 0, 1);
-    result = gradient_z(pos, 1, 0.0f);
-    {
-        uniform float noise_persistence = noise_settings->persistence;
-        uniform float noise_lacunarity = noise_settings->lacunarity;
-        uniform float noise_scale = noise_settings->scale;
-        uniform float noise_amplitude = noise_settings->amplitude;
-        for (uniform int i = 0; i < noise_settings->octaves; ++i) {
-            pos = m * pos;
-            inv = mi * inv;
-            DensityNrm dn = noise(random_ctx, pos, noise_scale, noise_amplitude);
-            result.val += dn.val;
-            result.nrm += inv * dn.nrm;
-            noise_scale *= noise_lacunarity;
-            noise_amplitude *= noise_persistence;
-        }
+static inline float generator_plane_value(uniform GeneratorNode const *uniform node, vec3 pos) {
+    return node->params[0] * pos.x + node->params[1] * pos.y + node->params[2] * pos.z - node->params[3];
+}
+static inline float generator_octaves_value(RandomCtx random_ctx, uniform GeneratorNode const *uniform node, vec3 pos, uniform int octave_count) {
+    uniform float noise_persistence = node->params[0];
+    uniform float noise_lacunarity = node->params[1];
+    uniform float noise_scale = node->params[2];
+    uniform float noise_amplitude = node->params[3];
+    float result = 0.0f;
+    for (uniform int i = 0; i < octave_count; ++i) {
+        pos = m * pos;
+        result += noise_density(random_ctx, pos, noise_scale, noise_amplitude);
+        noise_scale *= noise_lacunarity;
+        noise_amplitude *= noise_persistence;
     }
-    result.nrm = normalize(result.nrm);
     return result;
 }
-static inline MinMax voxel_minmax_value(RandomCtx random_ctx, uniform NoiseSettings const *uniform noise_settings, vec3 p0, vec3 p1) {
-    MinMax result = {0, 0};
-    // MinMax sphere_minmax = {-1, 1};
-    // result = result + sphere_minmax;
-    result = result + minmax_gradient_z(p0, p1, 1, 0.0f);
-    {
-        uniform float noise_persistence = noise_settings->persistence;
-        uniform float noise_lacunarity = noise_settings->lacunarity;
-        uniform float noise_scale = noise_settings->scale;
-        uniform float noise_amplitude = noise_settings->amplitude;
-        for (uniform int i = 0; i < noise_settings->octaves; ++i) {
-            p0 = m * p0;
-            p1 = m * p1;
-            result = result + minmax_noise_in_region(random_ctx, (p0 + p1) * 0.5f, abs(p1 - p0), noise_scale, noise_amplitude);
-            noise_scale *= noise_lacunarity;
-            noise_amplitude *= noise_persistence;
+
+// The density of the generator program at pos. Negative is solid.
+static inline float generator_value(RandomCtx random_ctx, uniform GeneratorProgram const *uniform program, vec3 pos) {
+    float stack[GENERATOR_MAX_STACK_SIZE];
+    vec3 domains[GENERATOR_MAX_DOMAIN_DEPTH];
+    uniform int stack_size = 0;
+    uniform int domain_depth = 0;
+
+    for (uniform int node_i = 0; node_i < program->node_count; ++node_i) {
+        uniform GeneratorNode const *uniform node = &program->nodes[node_i];
+        switch (node->op) {
+        case GENERATOR_OP_CONSTANT: {
+            stack[stack_size++] = node->params[0];
+        } break;
+        case GENERATOR_OP_PLANE: {
+            stack[stack_size++] = generator_plane_value(node, pos);
+        } break;
+        case GENERATOR_OP_SPHERE: {
+            vec3 center = {node->params[0], node->params[1], node->params[2]};
+            stack[stack_size++] = length(pos - center) - node->params[3];
+        } break;
+        case GENERATOR_OP_OCTAVES: {
+            stack[stack_size++] = generator_octaves_value(random_ctx, node, pos, node->octave_count);
+        } break;
+        case GENERATOR_OP_ADD: {
+            float b = stack[--stack_size];
+            stack[stack_size - 1] = stack[stack_size - 1] + b;
+        } break;
+        case GENERATOR_OP_MULTIPLY: {
+            float b = stack[--stack_size];
+            stack[stack_size - 1] = stack[stack_size - 1] * b;
+        } break;
+        case GENERATOR_OP_UNION: {
+            float b = stack[--stack_size];
+            stack[stack_size - 1] = min(stack[stack_size - 1], b);
+        } break;
+        case GENERATOR_OP_INTERSECTION: {
+            float b = stack[--stack_size];
+            stack[stack_size - 1] = max(stack[stack_size - 1], b);
+        } break;
+        case GENERATOR_OP_DIFFERENCE: {
+            float b = stack[--stack_size];
+            stack[stack_size - 1] = max(stack[stack_size - 1], -b);
+        } break;
+        case GENERATOR_OP_PUSH_ROTATION: {
+            domains[domain_depth++] = pos;
+            pos = generator_rotate(node->params, pos);
+        } break;
+        case GENERATOR_OP_POP_DOMAIN: {
+            pos = domains[--domain_depth];
+        } break;
         }
     }
-    return result;
+    return stack[0];
+}
+
+// The density of a generator program, in the kernel variant for octave_count. Variant 0 runs any
+// program, the others only plane plus octave_count octaves programs, with the octave loop unrolled.
+static inline float generator_variant_value(RandomCtx random_ctx, uniform GeneratorProgram const *uniform generator, vec3 pos, uniform int octave_count) {
+    if (octave_count == 0) {
+        return generator_value(random_ctx, generator, pos);
+    }
+    return generator_plane_value(&generator->nodes[0], pos) + generator_octaves_value(random_ctx, &generator->nodes[1], pos, octave_count);
+}
+
+// Bounds the density of the generator program over the box from p0 to p1
+static inline MinMax generator_minmax(RandomCtx random_ctx, uniform GeneratorProgram const *uniform program, vec3 p0, vec3 p1) {
+    MinMax stack[GENERATOR_MAX_STACK_SIZE];
+    vec3 domain_centers[GENERATOR_MAX_DOMAIN_DEPTH];
+    vec3 domain_extents[GENERATOR_MAX_DOMAIN_DEPTH];
+    uniform int stack_size = 0;
+    uniform int domain_depth = 0;
+    vec3 center = (p0 + p1) * 0.5f;
+    vec3 extent = abs(p1 - p0) * 0.5f;
+
+    for (uniform int node_i = 0; node_i < program->node_count; ++node_i) {
+        uniform GeneratorNode const *uniform node = &program->nodes[node_i];
+        switch (node->op) {
+        case GENERATOR_OP_CONSTANT: {
+            MinMax result = {node->params[0], node->params[0]};
+            stack[stack_size++] = result;
+        } break;
+        case GENERATOR_OP_PLANE: {
+            float value = node->params[0] * center.x + node->params[1] * center.y + node->params[2] * center.z - node->params[3];
+            float range = abs(node->params[0]) * extent.x + abs(node->params[1]) * extent.y + abs(node->params[2]) * extent.z;
+            MinMax result = {value - range, value + range};
+            stack[stack_size++] = result;
+        } break;
+        case GENERATOR_OP_SPHERE: {
+            vec3 sphere_center = {node->params[0], node->params[1], node->params[2]};
+            float dist = length(center - sphere_center);
+            float range = length(extent);
+            MinMax result = {max(dist - range, 0.0f) - node->params[3], dist + range - node->params[3]};
+            stack[stack_size++] = result;
+        } break;
+        case GENERATOR_OP_OCTAVES: {
+            uniform float noise_persistence = node->params[0];
+            uniform float noise_lacunarity = node->params[1];
+            uniform float noise_scale = node->params[2];
+            uniform float noise_amplitude = node->params[3];
+            // the octave rotations are orthonormal, so the size of the region stays the same
+            vec3 p = center;
+            MinMax result = {0, 0};
+            for (uniform int i = 0; i < node->octave_count; ++i) {
+                p = m * p;
+                result = result + minmax_noise_in_region(random_ctx, p, extent * 2.0f, noise_scale, noise_amplitude);
+                noise_scale *= noise_lacunarity;
+                noise_amplitude *= noise_persistence;
+            }
+            stack[stack_size++] = result;
+        } break;
+        case GENERATOR_OP_ADD: {
+            MinMax b = stack[--stack_size];
+            stack[stack_size - 1] = stack[stack_size - 1] + b;
+        } break;
+        case GENERATOR_OP_MULTIPLY: {
+            MinMax b = stack[--stack_size];
+            MinMax a = stack[stack_size - 1];
+            float p00 = a.min * b.min;
+            float p01 = a.min * b.max;
+            float p10 = a.max * b.min;
+            float p11 = a.max * b.max;
+            MinMax result = {min(min(p00, p01), min(p10, p11)), max(max(p00, p01), max(p10, p11))};
+            stack[stack_size - 1] = result;
+        } break;
+        case GENERATOR_OP_UNION: {
+            MinMax b = stack[--stack_size];
+            MinMax a = stack[stack_size - 1];
+            MinMax result = {min(a.min, b.min), min(a.max, b.max)};
+            stack[stack_size - 1] = result;
+        } break;
+        case GENERATOR_OP_INTERSECTION: {
+            MinMax b = stack[--stack_size];
+            MinMax a = stack[stack_size - 1];
+            MinMax result = {max(a.min, b.min), max(a.max, b.max)};
+            stack[stack_size - 1] = result;
+        } break;
+        case GENERATOR_OP_DIFFERENCE: {
+            MinMax b = stack[--stack_size];
+            MinMax a = stack[stack_size - 1];
+            MinMax result = {max(a.min, -b.max), max(a.max, -b.min)};
+            stack[stack_size - 1] = result;
+        } break;
+        case GENERATOR_OP_PUSH_ROTATION: {
+            domain_centers[domain_depth] = center;
+            domain_extents[domain_depth] = extent;
+            ++domain_depth;
+            center = generator_rotate(node->params, center);
+            extent = generator_rotate_extent(node->params, extent);
+        } break;
+        case GENERATOR_OP_POP_DOMAIN: {
+            --domain_depth;
+            center = domain_centers[domain_depth];
+            extent = domain_extents[domain_depth];
+        } break;
+        }
+    }
+    return stack[0];
+}
+
+// The normal at voxel (xi, yi, zi) of the brick in a density tile, by central differences.
+static inline vec3 density_tile_normal(uniform float const tile[], int xi, int yi, int zi) {
+    int i = (xi + 1) + (yi + 1) * DENSITY_TILE_SIZE + (zi + 1) * DENSITY_TILE_SIZE * DENSITY_TILE_SIZE;
+    vec3 result;
+    result.x = tile[i + 1] - tile[i - 1];
+    result.y = tile[i + DENSITY_TILE_SIZE] - tile[i - DENSITY_TILE_SIZE];
+    result.z = tile[i + DENSITY_TILE_SIZE * DENSITY_TILE_SIZE] - tile[i - DENSITY_TILE_SIZE * DENSITY_TILE_SIZE];
+    return normalize(result);
 }
 
 // Building an Orthonormal Basis, Revisited
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <voxels/defs.inl>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+// Densities that generate_bitmask evaluated for bricks that are likely to end up on the surface, so that
+// generate_attributes only has to evaluate the normals. The cache is direct-mapped with a fixed number of
+// entries: a brick that gets displaced before its attributes are generated is just evaluated again.
+// Entries are only valid for the noise settings they were generated with.
+struct DensityCache {
+    static constexpr uint32_t ENTRY_COUNT_LOG2 = 14;
+    static constexpr uint32_t ENTRY_COUNT = 1u << ENTRY_COUNT_LOG2;
+    static constexpr uint32_t LOCK_COUNT = 64;
+    static constexpr uint64_t EMPTY_KEY = ~uint64_t{0};
+
+    struct Entry {
+        uint64_t chunk_key = EMPTY_KEY;
+        uint32_t brick_index = 0;
+        float densities[VOXELS_PER_BRICK];
+    };
+
+    void insert(uint64_t chunk_key, uint32_t brick_index, float const densities[]) {
+        auto entry_i = get_entry_index(chunk_key, brick_index);
+        auto &entry = entries[entry_i];
+        auto lock = std::lock_guard{locks[entry_i % LOCK_COUNT]};
+        entry.chunk_key = chunk_key;
+        entry.brick_index = brick_index;
+        std::memcpy(entry.densities, densities, sizeof(entry.densities));
+    }
+
+    // Copies the densities of the brick out of the cache and drops its entry. Returns false on a miss.
+    auto take(uint64_t chunk_key, uint32_t brick_index, float densities[]) -> bool {
+        auto entry_i = get_entry_index(chunk_key, brick_index);
+        auto &entry = entries[entry_i];
+        auto lock = std::lock_guard{locks[entry_i % LOCK_COUNT]};
+        if (entry.chunk_key != chunk_key || entry.brick_index != brick_index) {
+            return false;
+        }
+        std::memcpy(densities, entry.densities, sizeof(entry.densities));
+        entry.chunk_key = EMPTY_KEY;
+        return true;
+    }
+
+  private:
+    static auto get_entry_index(uint64_t chunk_key, uint32_t brick_index) -> uint32_t {
+        // bricks of a chunk stay in one contiguous run of entries
+        auto chunk_hash = (chunk_key * 0x9e3779b97f4a7c15ull) >> (64 - ENTRY_COUNT_LOG2);
+        return uint32_t(chunk_hash + brick_index) & (ENTRY_COUNT - 1);
+    }
+
+    std::unique_ptr<Entry[]> entries = std::make_unique<Entry[]>(ENTRY_COUNT);
+    std::array<std::mutex, LOCK_COUNT> locks = {};
+};
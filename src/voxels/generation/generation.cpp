@@ -1,23 +1,62 @@
 #include "common.hpp"
 
-MinMax voxel_minmax_value_cpp(NoiseSettings const *noise_settings, RandomCtx random_ctx, float p0x, float p0y, float p0z, float p1x, float p1y, float p1z) {
-    return voxel_minmax_value(random_ctx, noise_settings, vec3(p0x, p0y, p0z), vec3(p1x, p1y, p1z));
+MinMax generator_minmax_cpp(GeneratorProgram const *generator, RandomCtx random_ctx, float p0x, float p0y, float p0z, float p1x, float p1y, float p1z) {
+    return generator_minmax(random_ctx, generator, vec3(p0x, p0y, p0z), vec3(p1x, p1y, p1z));
 }
 
-void generate_bitmask_cpp(
+void density_tile_normal_cpp(float const tile[], int xi, int yi, int zi, float nrm[3]) {
+    vec3 result = density_tile_normal(tile, xi, yi, zi);
+    nrm[0] = result.x;
+    nrm[1] = result.y;
+    nrm[2] = result.z;
+}
+
+void classify_bricks_cpp(
+    int chunk_xi, int chunk_yi, int chunk_zi,
+    int level_i, int brick_size, int count,
+    uint const brick_indices[], uint occupancies[],
+    GeneratorProgram const *generator, RandomCtx random_ctx) {
+    float extent = float((brick_size * VOXEL_BRICK_SIZE) << level_i) * VOXEL_SIZE;
+
+    for (int cube_i = 0; cube_i < count; ++cube_i) {
+        uint brick_index = brick_indices[cube_i];
+        int xi = brick_index & (BRICK_CHUNK_SIZE - 1);
+        int yi = (brick_index >> BRICK_CHUNK_SIZE_LOG2) & (BRICK_CHUNK_SIZE - 1);
+        int zi = (brick_index >> (BRICK_CHUNK_SIZE_LOG2 * 2)) & (BRICK_CHUNK_SIZE - 1);
+
+        float x = (float((xi * VOXEL_BRICK_SIZE + chunk_xi * VOXEL_CHUNK_SIZE) << level_i) + 0.5f) * VOXEL_SIZE;
+        float y = (float((yi * VOXEL_BRICK_SIZE + chunk_yi * VOXEL_CHUNK_SIZE) << level_i) + 0.5f) * VOXEL_SIZE;
+        float z = (float((zi * VOXEL_BRICK_SIZE + chunk_zi * VOXEL_CHUNK_SIZE) << level_i) + 0.5f) * VOXEL_SIZE;
+
+        MinMax minmax = generator_minmax(random_ctx, generator, vec3(x, y, z), vec3(x + extent, y + extent, z + extent));
+        if (minmax.min >= 0.0f) {
+            occupancies[cube_i] = 0;
+        } else if (minmax.max < 0.0f) {
+            occupancies[cube_i] = 1;
+        } else {
+            occupancies[cube_i] = 2;
+        }
+    }
+}
+
+template <int OCTAVE_COUNT>
+void generate_bitmask_variant(
     int brick_xi, int brick_yi, int brick_zi,
     int chunk_xi, int chunk_yi, int chunk_zi,
-    int level_i, uint bits[], uint *uniform metadata,
-    NoiseSettings const *noise_settings, RandomCtx random_ctx) {
+    int level_i, uint bits[], uint *uniform metadata, float densities[],
+    GeneratorProgram const *generator, RandomCtx random_ctx) {
+    int voxel_scale = 1 << level_i;
+    ivec3 origin = ivec3(brick_xi * VOXEL_BRICK_SIZE + chunk_xi * VOXEL_CHUNK_SIZE, brick_yi * VOXEL_BRICK_SIZE + chunk_yi * VOXEL_CHUNK_SIZE, brick_zi * VOXEL_BRICK_SIZE + chunk_zi * VOXEL_CHUNK_SIZE) * voxel_scale;
 
     for (int zi = 0; zi < VOXEL_BRICK_SIZE; ++zi) {
         for (int yi = 0; yi < VOXEL_BRICK_SIZE; ++yi) {
             for (int xi = 0; xi < VOXEL_BRICK_SIZE; ++xi) {
-                float x = (float((xi + brick_xi * VOXEL_BRICK_SIZE + chunk_xi * VOXEL_CHUNK_SIZE) * (1 << level_i)) + 0.5f) * VOXEL_SIZE;
-                float y = (float((yi + brick_yi * VOXEL_BRICK_SIZE + chunk_yi * VOXEL_CHUNK_SIZE) * (1 << level_i)) + 0.5f) * VOXEL_SIZE;
-                float z = (float((zi + brick_zi * VOXEL_BRICK_SIZE + chunk_zi * VOXEL_CHUNK_SIZE) * (1 << level_i)) + 0.5f) * VOXEL_SIZE;
+                float x = (float(origin.x + xi * voxel_scale) + 0.5f) * VOXEL_SIZE;
+                float y = (float(origin.y + yi * voxel_scale) + 0.5f) * VOXEL_SIZE;
+                float z = (float(origin.z + zi * voxel_scale) + 0.5f) * VOXEL_SIZE;
 
-                uint value = voxel_value(random_ctx, noise_settings, vec3(x, y, z)).val < 0.0f ? 1 : 0;
+                float density = generator_variant_value(random_ctx, generator, vec3(x, y, z), OCTAVE_COUNT);
+                uint value = density < 0.0f ? 1 : 0;
 
                 if (value != 0) {
                     *metadata |= (1 << 12);
@@ -39,6 +78,7 @@ void generate_bitmask_cpp(
                 }
 
                 uint voxel_index = xi + yi * VOXEL_BRICK_SIZE + zi * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE;
+                densities[voxel_index] = density;
                 uint voxel_word_index = voxel_index / 32;
                 uint voxel_in_word_index = voxel_index % 32;
                 bits[voxel_word_index] |= uint32_t(value) << voxel_in_word_index;
@@ -47,20 +87,86 @@ void generate_bitmask_cpp(
     }
 }
 
-void generate_attributes_cpp(
+template <int OCTAVE_COUNT>
+void generate_density_tile_variant(
+    int brick_xi, int brick_yi, int brick_zi,
+    int chunk_xi, int chunk_yi, int chunk_zi,
+    int level_i, float tile[], float const densities[], bool densities_known,
+    GeneratorProgram const *generator, RandomCtx random_ctx) {
+    int voxel_scale = 1 << level_i;
+    ivec3 origin = ivec3(brick_xi * VOXEL_BRICK_SIZE + chunk_xi * VOXEL_CHUNK_SIZE - 1, brick_yi * VOXEL_BRICK_SIZE + chunk_yi * VOXEL_CHUNK_SIZE - 1, brick_zi * VOXEL_BRICK_SIZE + chunk_zi * VOXEL_CHUNK_SIZE - 1) * voxel_scale;
+
+    for (int zi = 0; zi < DENSITY_TILE_SIZE; ++zi) {
+        for (int yi = 0; yi < DENSITY_TILE_SIZE; ++yi) {
+            for (int xi = 0; xi < DENSITY_TILE_SIZE; ++xi) {
+                int tile_index = xi + yi * DENSITY_TILE_SIZE + zi * DENSITY_TILE_SIZE * DENSITY_TILE_SIZE;
+                bool is_border = xi == 0 || yi == 0 || zi == 0 || xi == DENSITY_TILE_SIZE - 1 || yi == DENSITY_TILE_SIZE - 1 || zi == DENSITY_TILE_SIZE - 1;
+                if (densities_known && !is_border) {
+                    tile[tile_index] = densities[(xi - 1) + (yi - 1) * VOXEL_BRICK_SIZE + (zi - 1) * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE];
+                    continue;
+                }
+                float x = (float(origin.x + xi * voxel_scale) + 0.5f) * VOXEL_SIZE;
+                float y = (float(origin.y + yi * voxel_scale) + 0.5f) * VOXEL_SIZE;
+                float z = (float(origin.z + zi * voxel_scale) + 0.5f) * VOXEL_SIZE;
+                tile[tile_index] = generator_variant_value(random_ctx, generator, vec3(x, y, z), OCTAVE_COUNT);
+            }
+        }
+    }
+}
+
+using GenerateBitmaskFunc = void (*)(int, int, int, int, int, int, int, uint[], uint *, float[], GeneratorProgram const *, RandomCtx);
+using GenerateDensityTileFunc = void (*)(int, int, int, int, int, int, int, float[], float const[], bool, GeneratorProgram const *, RandomCtx);
+
+// Indexed by GeneratorProgram::terrain_octave_count
+static constexpr GenerateBitmaskFunc GENERATE_BITMASK_VARIANTS[] = {
+    generate_bitmask_variant<0>,
+    generate_bitmask_variant<1>,
+    generate_bitmask_variant<2>,
+    generate_bitmask_variant<3>,
+    generate_bitmask_variant<4>,
+    generate_bitmask_variant<5>,
+    generate_bitmask_variant<6>,
+    generate_bitmask_variant<7>,
+    generate_bitmask_variant<8>,
+};
+static constexpr GenerateDensityTileFunc GENERATE_DENSITY_TILE_VARIANTS[] = {
+    generate_density_tile_variant<0>,
+    generate_density_tile_variant<1>,
+    generate_density_tile_variant<2>,
+    generate_density_tile_variant<3>,
+    generate_density_tile_variant<4>,
+    generate_density_tile_variant<5>,
+    generate_density_tile_variant<6>,
+    generate_density_tile_variant<7>,
+    generate_density_tile_variant<8>,
+};
+static_assert(sizeof(GENERATE_BITMASK_VARIANTS) / sizeof(GENERATE_BITMASK_VARIANTS[0]) == GENERATOR_MAX_SPECIALIZED_OCTAVES + 1);
+static_assert(sizeof(GENERATE_DENSITY_TILE_VARIANTS) / sizeof(GENERATE_DENSITY_TILE_VARIANTS[0]) == GENERATOR_MAX_SPECIALIZED_OCTAVES + 1);
+
+void generate_bitmask_cpp(
+    int brick_xi, int brick_yi, int brick_zi,
+    int chunk_xi, int chunk_yi, int chunk_zi,
+    int level_i, uint bits[], uint *uniform metadata, float densities[],
+    GeneratorProgram const *generator, RandomCtx random_ctx) {
+    GENERATE_BITMASK_VARIANTS[generator->terrain_octave_count](brick_xi, brick_yi, brick_zi, chunk_xi, chunk_yi, chunk_zi, level_i, bits, metadata, densities, generator, random_ctx);
+}
+
+void generate_density_tile_cpp(
     int brick_xi, int brick_yi, int brick_zi,
     int chunk_xi, int chunk_yi, int chunk_zi,
-    int level_i, uint packed_voxels[], float densities[],
-    NoiseSettings const *noise_settings, RandomCtx random_ctx) {
+    int level_i, float tile[], float const densities[], bool densities_known,
+    GeneratorProgram const *generator, RandomCtx random_ctx) {
+    GENERATE_DENSITY_TILE_VARIANTS[generator->terrain_octave_count](brick_xi, brick_yi, brick_zi, chunk_xi, chunk_yi, chunk_zi, level_i, tile, densities, densities_known, generator, random_ctx);
+}
 
+void generate_attributes_cpp(uint packed_voxels[], float densities[], float const tile[], RandomCtx random_ctx) {
     for (int zi = 0; zi < VOXEL_BRICK_SIZE; ++zi) {
         for (int yi = 0; yi < VOXEL_BRICK_SIZE; ++yi) {
             for (int xi = 0; xi < VOXEL_BRICK_SIZE; ++xi) {
                 uint32_t voxel_index = xi + yi * VOXEL_BRICK_SIZE + zi * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE;
-                float x = (float((xi + brick_xi * VOXEL_BRICK_SIZE + chunk_xi * VOXEL_CHUNK_SIZE) * (1 << level_i)) + 0.5f) * VOXEL_SIZE;
-                float y = (float((yi + brick_yi * VOXEL_BRICK_SIZE + chunk_yi * VOXEL_CHUNK_SIZE) * (1 << level_i)) + 0.5f) * VOXEL_SIZE;
-                float z = (float((zi + brick_zi * VOXEL_BRICK_SIZE + chunk_zi * VOXEL_CHUNK_SIZE) * (1 << level_i)) + 0.5f) * VOXEL_SIZE;
-                auto dn = voxel_value(random_ctx, noise_settings, glm::vec3(x, y, z));
+                auto dn = DensityNrm{};
+                dn.val = tile[(xi + 1) + (yi + 1) * DENSITY_TILE_SIZE + (zi + 1) * DENSITY_TILE_SIZE * DENSITY_TILE_SIZE];
+                dn.nrm = density_tile_normal(tile, xi, yi, zi);
                 auto col = glm::vec3(0.0f);
                 if (dot(dn.nrm, vec3(0, 0, 1)) > 0.5f && dn.val > -0.5f) {
                     col = glm::vec3(12, 163, 7) / 255.0f;
@@ -2,46 +2,78 @@
 
 #include <voxels/defs.inl>
 
-MinMax voxel_minmax_value_cpp(NoiseSettings const *noise_settings, RandomCtx random_ctx, float p0x, float p0y, float p0z, float p1x, float p1y, float p1z);
+MinMax generator_minmax_cpp(GeneratorProgram const *generator, RandomCtx random_ctx, float p0x, float p0y, float p0z, float p1x, float p1y, float p1z);
+void density_tile_normal_cpp(float const tile[], int xi, int yi, int zi, float nrm[3]);
 
 #if USE_ISPC
 #include <generation_ispc.h>
 #else
 
+void classify_bricks_cpp(
+    int chunk_xi, int chunk_yi, int chunk_zi,
+    int level_i, int brick_size, int count,
+    unsigned int const brick_indices[], unsigned int occupancies[],
+    GeneratorProgram const *generator, RandomCtx random_ctx);
+
 void generate_bitmask_cpp(
     int brick_xi, int brick_yi, int brick_zi,
     int chunk_xi, int chunk_yi, int chunk_zi,
-    int level_i, unsigned int bits[], unsigned int *metadata,
-    NoiseSettings const *noise_settings, RandomCtx random_ctx);
+    int level_i, unsigned int bits[], unsigned int *metadata, float densities[],
+    GeneratorProgram const *generator, RandomCtx random_ctx);
 
-void generate_attributes_cpp(
+void generate_density_tile_cpp(
     int brick_xi, int brick_yi, int brick_zi,
     int chunk_xi, int chunk_yi, int chunk_zi,
-    int level_i, unsigned int packed_voxels[], float densities[],
-    NoiseSettings const *noise_settings, RandomCtx random_ctx);
+    int level_i, float tile[], float const densities[], bool densities_known,
+    GeneratorProgram const *generator, RandomCtx random_ctx);
 
+void generate_attributes_cpp(unsigned int packed_voxels[], float densities[], float const tile[], RandomCtx random_ctx);
+
+#endif
+
+static inline void classify_bricks(
+    int chunk_xi, int chunk_yi, int chunk_zi,
+    int level_i, int brick_size, int count,
+    unsigned int const brick_indices[], unsigned int occupancies[],
+    GeneratorProgram const *generator, RandomCtx random_ctx) {
+#if USE_ISPC
+    ispc::classify_bricks(chunk_xi, chunk_yi, chunk_zi, level_i, brick_size, count, brick_indices, occupancies, reinterpret_cast<ispc::GeneratorProgram const *>(generator), random_ctx);
+#else
+    classify_bricks_cpp(chunk_xi, chunk_yi, chunk_zi, level_i, brick_size, count, brick_indices, occupancies, generator, random_ctx);
 #endif
+}
 
 static inline void generate_bitmask(
     int brick_xi, int brick_yi, int brick_zi,
     int chunk_xi, int chunk_yi, int chunk_zi,
-    int level_i, unsigned int bits[], unsigned int *metadata,
-    NoiseSettings const *noise_settings, RandomCtx random_ctx) {
+    int level_i, unsigned int bits[], unsigned int *metadata, float densities[],
+    GeneratorProgram const *generator, RandomCtx random_ctx) {
 #if USE_ISPC
-    ispc::generate_bitmask(brick_xi, brick_yi, brick_zi, chunk_xi, chunk_yi, chunk_zi, level_i, bits, metadata, reinterpret_cast<ispc::NoiseSettings const *>(noise_settings), random_ctx);
+    ispc::generate_bitmask(brick_xi, brick_yi, brick_zi, chunk_xi, chunk_yi, chunk_zi, level_i, bits, metadata, densities, reinterpret_cast<ispc::GeneratorProgram const *>(generator), random_ctx);
 #else
-    generate_bitmask_cpp(brick_xi, brick_yi, brick_zi, chunk_xi, chunk_yi, chunk_zi, level_i, bits, metadata, noise_settings, random_ctx);
+    generate_bitmask_cpp(brick_xi, brick_yi, brick_zi, chunk_xi, chunk_yi, chunk_zi, level_i, bits, metadata, densities, generator, random_ctx);
 #endif
 }
 
-static inline void generate_attributes(
+// Fills a density tile for the brick. With densities_known, the inner voxels are copied from densities
+// and only the border gets evaluated.
+static inline void generate_density_tile(
     int brick_xi, int brick_yi, int brick_zi,
     int chunk_xi, int chunk_yi, int chunk_zi,
-    int level_i, unsigned int packed_voxels[], float densities[],
-    NoiseSettings const *noise_settings, RandomCtx random_ctx) {
+    int level_i, float tile[], float const densities[], bool densities_known,
+    GeneratorProgram const *generator, RandomCtx random_ctx) {
+#if USE_ISPC
+    ispc::generate_density_tile(brick_xi, brick_yi, brick_zi, chunk_xi, chunk_yi, chunk_zi, level_i, tile, densities, densities_known, reinterpret_cast<ispc::GeneratorProgram const *>(generator), random_ctx);
+#else
+    generate_density_tile_cpp(brick_xi, brick_yi, brick_zi, chunk_xi, chunk_yi, chunk_zi, level_i, tile, densities, densities_known, generator, random_ctx);
+#endif
+}
+
+// Colors and normals of a brick from its density tile
+static inline void generate_attributes(unsigned int packed_voxels[], float densities[], float const tile[], RandomCtx random_ctx) {
 #if USE_ISPC
-    ispc::generate_attributes(brick_xi, brick_yi, brick_zi, chunk_xi, chunk_yi, chunk_zi, level_i, packed_voxels, densities, reinterpret_cast<ispc::NoiseSettings const *>(noise_settings), random_ctx);
+    ispc::generate_attributes(packed_voxels, densities, tile, random_ctx);
 #else
-    generate_attributes_cpp(brick_xi, brick_yi, brick_zi, chunk_xi, chunk_yi, chunk_zi, level_i, packed_voxels, densities, noise_settings, random_ctx);
+    generate_attributes_cpp(packed_voxels, densities, tile, random_ctx);
 #endif
 }
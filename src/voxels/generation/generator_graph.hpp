@@ -0,0 +1,121 @@
+#pragma once
+
+#include <voxels/defs.inl>
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// Terrain as a tree of generator nodes. compile_generator() flattens it into the GeneratorProgram that
+// the generation kernels evaluate, for both densities and the interval bounds used to cull empty space.
+struct GeneratorGraph {
+    using NodeId = uint32_t;
+
+    struct Node {
+        int op = GENERATOR_OP_CONSTANT;
+        int octave_count = 0;
+        std::array<float, 9> params = {};
+        std::array<NodeId, 2> children = {};
+        uint32_t child_count = 0;
+    };
+
+    std::vector<Node> nodes;
+
+    auto constant(float value) -> NodeId {
+        return push({.op = GENERATOR_OP_CONSTANT, .params = {value}});
+    }
+    auto plane(float normal_x, float normal_y, float normal_z, float offset) -> NodeId {
+        return push({.op = GENERATOR_OP_PLANE, .params = {normal_x, normal_y, normal_z, offset}});
+    }
+    auto sphere(float center_x, float center_y, float center_z, float radius) -> NodeId {
+        return push({.op = GENERATOR_OP_SPHERE, .params = {center_x, center_y, center_z, radius}});
+    }
+    auto octaves(NoiseSettings const &settings) -> NodeId {
+        return push({
+            .op = GENERATOR_OP_OCTAVES,
+            .octave_count = settings.octaves,
+            .params = {settings.persistence, settings.lacunarity, settings.scale, settings.amplitude},
+        });
+    }
+    auto add(NodeId a, NodeId b) -> NodeId {
+        return push({.op = GENERATOR_OP_ADD, .children = {a, b}, .child_count = 2});
+    }
+    auto multiply(NodeId a, NodeId b) -> NodeId {
+        return push({.op = GENERATOR_OP_MULTIPLY, .children = {a, b}, .child_count = 2});
+    }
+    auto csg_union(NodeId a, NodeId b) -> NodeId {
+        return push({.op = GENERATOR_OP_UNION, .children = {a, b}, .child_count = 2});
+    }
+    auto csg_intersection(NodeId a, NodeId b) -> NodeId {
+        return push({.op = GENERATOR_OP_INTERSECTION, .children = {a, b}, .child_count = 2});
+    }
+    // Carves b out of a
+    auto csg_difference(NodeId a, NodeId b) -> NodeId {
+        return push({.op = GENERATOR_OP_DIFFERENCE, .children = {a, b}, .child_count = 2});
+    }
+    // Evaluates child at positions rotated by the column-major 3x3 matrix
+    auto rotate(std::array<float, 9> const &matrix, NodeId child) -> NodeId {
+        return push({.op = GENERATOR_OP_PUSH_ROTATION, .params = matrix, .children = {child}, .child_count = 1});
+    }
+
+  private:
+    auto push(Node const &node) -> NodeId {
+        nodes.push_back(node);
+        return NodeId(nodes.size() - 1);
+    }
+};
+
+// Emits the subtree at node_id in post-order. Rotations wrap their child in a push and a pop of the domain.
+static inline void emit_generator_node(GeneratorGraph const &graph, GeneratorGraph::NodeId node_id, GeneratorProgram &program, int stack_size, int domain_depth) {
+    auto const &node = graph.nodes.at(node_id);
+    auto emit = [&](int op, int octave_count, std::array<float, 9> const &params) {
+        if (program.node_count == GENERATOR_MAX_NODE_COUNT) {
+            throw std::length_error("generator graph has too many nodes");
+        }
+        auto &result = program.nodes[program.node_count++];
+        result.op = op;
+        result.octave_count = octave_count;
+        for (size_t i = 0; i < params.size(); ++i) {
+            result.params[i] = params[i];
+        }
+    };
+
+    if (node.op == GENERATOR_OP_PUSH_ROTATION) {
+        if (domain_depth == GENERATOR_MAX_DOMAIN_DEPTH) {
+            throw std::length_error("generator graph nests too many rotations");
+        }
+        emit(GENERATOR_OP_PUSH_ROTATION, 0, node.params);
+        emit_generator_node(graph, node.children[0], program, stack_size, domain_depth + 1);
+        emit(GENERATOR_OP_POP_DOMAIN, 0, {});
+        return;
+    }
+    for (uint32_t child_i = 0; child_i < node.child_count; ++child_i) {
+        emit_generator_node(graph, node.children[child_i], program, stack_size + int(child_i), domain_depth);
+    }
+    if (node.child_count == 0 && stack_size == GENERATOR_MAX_STACK_SIZE) {
+        throw std::length_error("generator graph is too deep");
+    }
+    emit(node.op, node.octave_count, node.params);
+}
+
+static inline auto compile_generator(GeneratorGraph const &graph, GeneratorGraph::NodeId root) -> GeneratorProgram {
+    auto result = GeneratorProgram{};
+    emit_generator_node(graph, root, result, 0, 0);
+    auto is_terrain = result.node_count == 3 &&
+                      result.nodes[0].op == GENERATOR_OP_PLANE &&
+                      result.nodes[1].op == GENERATOR_OP_OCTAVES &&
+                      result.nodes[2].op == GENERATOR_OP_ADD;
+    if (is_terrain && result.nodes[1].octave_count >= 1 && result.nodes[1].octave_count <= GENERATOR_MAX_SPECIALIZED_OCTAVES) {
+        result.terrain_octave_count = result.nodes[1].octave_count;
+    }
+    return result;
+}
+
+// The default terrain: a height gradient with octaves of noise on top
+static inline auto make_terrain_generator(NoiseSettings const &noise_settings) -> GeneratorProgram {
+    auto graph = GeneratorGraph{};
+    auto ground = graph.plane(0.0f, 0.0f, 1.0f, 0.0f);
+    auto noise = graph.octaves(noise_settings);
+    return compile_generator(graph, graph.add(ground, noise));
+}
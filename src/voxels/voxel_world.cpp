@@ -12,6 +12,7 @@
 
 #include <renderer/renderer.hpp>
 #include <utilities/thread_pool.hpp>
+#include <utilities/slab_allocator.hpp>
 #include <utilities/ispc_instrument.hpp>
 #include <utilities/debug.hpp>
 
@@ -22,8 +23,16 @@
 #include <vector>
 #include <thread>
 #include <filesystem>
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_set>
 
 #include "generation/generation.hpp"
+#include "generation/brick_faces.hpp"
+#include "generation/brick_downsample.hpp"
+#include "generation/density_cache.hpp"
+#include "generation/generator_graph.hpp"
 
 struct BrickMetadata {
     uint32_t exposed_nx : 1 {};
@@ -41,6 +50,12 @@ struct BrickMetadata {
     uint32_t has_voxel : 1 {};
 };
 
+enum Occupancy : uint32_t {
+    OCCUPANCY_AIR,
+    OCCUPANCY_SOLID,
+    OCCUPANCY_MIXED,
+};
+
 enum GenerationStage {
     NOT_GENERATED,
     GENERATED_BITMASK,
@@ -51,40 +66,412 @@ struct VoxelSimAttribBrick {
     float densities[VOXELS_PER_BRICK];
 };
 
-struct Brick {
-    VoxelBrickBitmask bitmask;
-    std::unique_ptr<VoxelRenderAttribBrick> render_attribs;
-    std::unique_ptr<VoxelSimAttribBrick> sim_attribs;
-    glm::ivec4 pos_scl;
+struct DensityTile {
+    float densities[VOXELS_PER_DENSITY_TILE];
 };
 
+using BrickSlot = uint32_t;
+using RenderAttribHandle = uint32_t;
+using SimAttribHandle = uint32_t;
+
+// Attribute bricks are pooled, since world generation creates millions of them
+static SlabAllocator<VoxelRenderAttribBrick> s_render_attrib_pool;
+static SlabAllocator<VoxelSimAttribBrick> s_sim_attrib_pool;
+
+// Uniform bricks don't get a slot, they're encoded in the slot index instead.
+constexpr BrickSlot BRICK_AIR = ~BrickSlot{0};
+constexpr BrickSlot BRICK_SOLID = ~BrickSlot{0} - 1;
+constexpr RenderAttribHandle INVALID_RENDER_ATTRIBS = SlabAllocator<VoxelRenderAttribBrick>::INVALID_HANDLE;
+constexpr SimAttribHandle INVALID_SIM_ATTRIBS = SlabAllocator<VoxelSimAttribBrick>::INVALID_HANDLE;
+
+auto get_brick_occupancy(BrickSlot slot) -> Occupancy {
+    switch (slot) {
+    case BRICK_AIR: return OCCUPANCY_AIR;
+    case BRICK_SOLID: return OCCUPANCY_SOLID;
+    default: return OCCUPANCY_MIXED;
+    }
+}
+auto is_mixed_brick(BrickSlot slot) -> bool {
+    return slot < BRICK_SOLID;
+}
+
 struct Chunk {
-    std::array<std::unique_ptr<Brick>, BRICKS_PER_CHUNK> bricks{};
+    // Maps every brick index to its slot in the brick arrays below, or to BRICK_AIR/BRICK_SOLID
+    std::array<BrickSlot, BRICKS_PER_CHUNK> bricks;
+    // Mixed bricks, as parallel arrays indexed by slot
+    std::vector<VoxelBrickBitmask> brick_bitmasks;
+    std::vector<RenderAttribHandle> brick_render_attribs;
+    std::vector<SimAttribHandle> brick_sim_attribs;
+
+    // Surface bricks in upload order, rebuilt by generate_chunk2
     std::vector<int> surface_brick_indices;
+    std::vector<VoxelBrickBitmask> surface_bitmasks;
+    std::vector<glm::ivec4> surface_pos_scls;
+    std::vector<VoxelRenderAttribBrick const *> surface_render_attribs;
 
     renderer::Chunk *render_chunk = nullptr;
     glm::vec3 pos;
-    bool bricks_changed;
+    glm::ivec3 chunk_i;
+    int32_t level;
+    uint32_t directory_index;
+    GenerationStage generation_stage = NOT_GENERATED;
+    // One bit per face (see NEIGHBOR_OFFSETS) for neighbors that are still queued for generation
+    uint8_t pending_neighbors = 0;
+
+    // See DirtyChunkQueue
+    std::atomic_uint32_t dirty_flags = 0;
+    Chunk *next_dirty = nullptr;
 
     Chunk() {
+        bricks.fill(BRICK_AIR);
     }
     ~Chunk() {
+        free_bricks();
         if (render_chunk != nullptr) {
             destroy_chunk(g_renderer, render_chunk);
         }
     }
+
+    auto allocate_brick() -> BrickSlot {
+        auto slot = BrickSlot(brick_bitmasks.size());
+        brick_bitmasks.emplace_back();
+        brick_render_attribs.push_back(INVALID_RENDER_ATTRIBS);
+        brick_sim_attribs.push_back(INVALID_SIM_ATTRIBS);
+        return slot;
+    }
+
+    void free_bricks(BrickSlot uniform_brick = BRICK_AIR) {
+        for (auto handle : brick_render_attribs) {
+            if (handle != INVALID_RENDER_ATTRIBS) {
+                s_render_attrib_pool.free(handle);
+            }
+        }
+        for (auto handle : brick_sim_attribs) {
+            if (handle != INVALID_SIM_ATTRIBS) {
+                s_sim_attrib_pool.free(handle);
+            }
+        }
+        brick_bitmasks.clear();
+        brick_render_attribs.clear();
+        brick_sim_attribs.clear();
+        bricks.fill(uniform_brick);
+    }
+
+    auto get_render_attribs(BrickSlot slot) const -> VoxelRenderAttribBrick * {
+        return s_render_attrib_pool.get(brick_render_attribs[slot]);
+    }
+    auto get_sim_attribs(BrickSlot slot) const -> VoxelSimAttribBrick * {
+        return s_sim_attrib_pool.get(brick_sim_attribs[slot]);
+    }
+};
+
+auto make_chunk(glm::ivec3 chunk_i, int32_t level) -> std::unique_ptr<Chunk> {
+    auto chunk = std::make_unique<Chunk>();
+    chunk->pos = chunk_i;
+    chunk->chunk_i = chunk_i;
+    chunk->level = level;
+    return chunk;
+}
+
+// Sparse chunk directory. An open-addressing (linear probing) hash table maps packed
+// (x, y, z, level) keys to indices into a dense list of live chunks, so that iterating
+// the world scales with the number of live chunks rather than with the world bounds.
+struct ChunkLookup {
+    bool found = false;
+    Occupancy occupancy = OCCUPANCY_AIR;
+    Chunk *chunk = nullptr;
+};
+
+struct ChunkDirectory {
+    static constexpr uint64_t EMPTY_KEY = ~uint64_t{0};
+    static constexpr uint32_t INITIAL_CAPACITY = 1 << 12;
+    // Uniform chunks are only an entry in the table, with one of these in place of a live_chunks index.
+    static constexpr uint32_t UNIFORM_AIR_INDEX = ~uint32_t{0};
+    static constexpr uint32_t UNIFORM_SOLID_INDEX = ~uint32_t{0} - 1;
+
+    std::vector<uint64_t> keys = std::vector<uint64_t>(INITIAL_CAPACITY, EMPTY_KEY);
+    std::vector<uint32_t> indices = std::vector<uint32_t>(INITIAL_CAPACITY);
+    std::vector<std::unique_ptr<Chunk>> live_chunks;
+    size_t entry_count = 0;
+    mutable std::shared_mutex mutex;
+
+    // Each axis gets 20 signed bits (+-524288 chunks) and the level gets the top 4 bits.
+    // The all-ones key would be level 15, which is never used, so it serves as EMPTY_KEY.
+    static constexpr auto pack_key(int32_t chunk_xi, int32_t chunk_yi, int32_t chunk_zi, int32_t level) -> uint64_t {
+        return (uint64_t(uint32_t(chunk_xi) & 0xfffff) << 0) |
+               (uint64_t(uint32_t(chunk_yi) & 0xfffff) << 20) |
+               (uint64_t(uint32_t(chunk_zi) & 0xfffff) << 40) |
+               (uint64_t(uint32_t(level) & 0xf) << 60);
+    }
+    static constexpr auto unpack_key(uint64_t key) -> glm::ivec4 {
+        return {
+            int32_t(uint32_t(key >> 0) << 12) >> 12,
+            int32_t(uint32_t(key >> 20) << 12) >> 12,
+            int32_t(uint32_t(key >> 40) << 12) >> 12,
+            int32_t(key >> 60),
+        };
+    }
+    static constexpr auto hash_key(uint64_t key) -> uint64_t {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ull;
+        key ^= key >> 33;
+        return key;
+    }
+
+    auto find_slot(uint64_t key) const -> size_t {
+        auto mask = keys.size() - 1;
+        auto slot = size_t(hash_key(key)) & mask;
+        while (keys[slot] != key && keys[slot] != EMPTY_KEY) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    void grow() {
+        auto old_keys = std::move(keys);
+        auto old_indices = std::move(indices);
+        keys = std::vector<uint64_t>(old_keys.size() * 2, EMPTY_KEY);
+        indices = std::vector<uint32_t>(old_keys.size() * 2);
+        for (size_t i = 0; i < old_keys.size(); ++i) {
+            if (old_keys[i] != EMPTY_KEY) {
+                auto slot = find_slot(old_keys[i]);
+                keys[slot] = old_keys[i];
+                indices[slot] = old_indices[i];
+            }
+        }
+    }
+
+    static constexpr auto is_uniform_index(uint32_t index) -> bool {
+        return index >= UNIFORM_SOLID_INDEX;
+    }
+
+    // Returns the slot for key, growing the table first if key would be a new entry.
+    auto find_or_reserve_slot(uint64_t key) -> size_t {
+        auto slot = find_slot(key);
+        // keep the load factor at or below 1/2
+        if (keys[slot] == EMPTY_KEY && (entry_count + 1) * 2 > keys.size()) {
+            grow();
+            slot = find_slot(key);
+        }
+        return slot;
+    }
+
+    // Only returns materialized chunks, uniform ones need lookup().
+    auto find(int32_t chunk_xi, int32_t chunk_yi, int32_t chunk_zi, int32_t level) const -> Chunk * {
+        auto key = pack_key(chunk_xi, chunk_yi, chunk_zi, level);
+        auto lock = std::shared_lock{mutex};
+        auto slot = find_slot(key);
+        if (keys[slot] == EMPTY_KEY || is_uniform_index(indices[slot])) {
+            return nullptr;
+        }
+        return live_chunks[indices[slot]].get();
+    }
+
+    auto lookup(int32_t chunk_xi, int32_t chunk_yi, int32_t chunk_zi, int32_t level) const -> ChunkLookup {
+        auto key = pack_key(chunk_xi, chunk_yi, chunk_zi, level);
+        auto lock = std::shared_lock{mutex};
+        auto slot = find_slot(key);
+        if (keys[slot] == EMPTY_KEY) {
+            return {};
+        }
+        switch (indices[slot]) {
+        case UNIFORM_AIR_INDEX: return {.found = true, .occupancy = OCCUPANCY_AIR};
+        case UNIFORM_SOLID_INDEX: return {.found = true, .occupancy = OCCUPANCY_SOLID};
+        default: return {.found = true, .occupancy = OCCUPANCY_MIXED, .chunk = live_chunks[indices[slot]].get()};
+        }
+    }
+
+    // Materializes a chunk, so that its bricks can be written. A uniform chunk gets filled
+    // with uniform bricks, while a chunk that was never generated is left NOT_GENERATED.
+    auto find_or_insert(int32_t chunk_xi, int32_t chunk_yi, int32_t chunk_zi, int32_t level) -> Chunk * {
+        auto key = pack_key(chunk_xi, chunk_yi, chunk_zi, level);
+        auto lock = std::unique_lock{mutex};
+        auto slot = find_or_reserve_slot(key);
+        if (keys[slot] != EMPTY_KEY && !is_uniform_index(indices[slot])) {
+            return live_chunks[indices[slot]].get();
+        }
+        auto &chunk = live_chunks.emplace_back(make_chunk({chunk_xi, chunk_yi, chunk_zi}, level));
+        chunk->directory_index = uint32_t(live_chunks.size() - 1);
+        if (keys[slot] == EMPTY_KEY) {
+            ++entry_count;
+        } else {
+            chunk->bricks.fill(indices[slot] == UNIFORM_SOLID_INDEX ? BRICK_SOLID : BRICK_AIR);
+            chunk->generation_stage = GENERATED_BITMASK;
+        }
+        keys[slot] = key;
+        indices[slot] = chunk->directory_index;
+        return chunk.get();
+    }
+
+    // Adds a chunk that was generated outside the directory, in place of a uniform entry if
+    // there is one. There must not be a materialized chunk with the same key already.
+    auto insert(std::unique_ptr<Chunk> new_chunk) -> Chunk * {
+        auto key = pack_key(new_chunk->chunk_i.x, new_chunk->chunk_i.y, new_chunk->chunk_i.z, new_chunk->level);
+        auto lock = std::unique_lock{mutex};
+        auto slot = find_or_reserve_slot(key);
+        if (keys[slot] == EMPTY_KEY) {
+            ++entry_count;
+        }
+        new_chunk->directory_index = uint32_t(live_chunks.size());
+        keys[slot] = key;
+        indices[slot] = new_chunk->directory_index;
+        return live_chunks.emplace_back(std::move(new_chunk)).get();
+    }
+
+    // Must not be used on a materialized chunk, since that would leave the Chunk dangling.
+    void set_uniform(int32_t chunk_xi, int32_t chunk_yi, int32_t chunk_zi, int32_t level, Occupancy occupancy) {
+        auto key = pack_key(chunk_xi, chunk_yi, chunk_zi, level);
+        auto lock = std::unique_lock{mutex};
+        auto slot = find_or_reserve_slot(key);
+        if (keys[slot] == EMPTY_KEY) {
+            ++entry_count;
+        }
+        keys[slot] = key;
+        indices[slot] = occupancy == OCCUPANCY_SOLID ? UNIFORM_SOLID_INDEX : UNIFORM_AIR_INDEX;
+    }
+
+    void erase(int32_t chunk_xi, int32_t chunk_yi, int32_t chunk_zi, int32_t level) {
+        auto key = pack_key(chunk_xi, chunk_yi, chunk_zi, level);
+        auto lock = std::unique_lock{mutex};
+        auto slot = find_slot(key);
+        if (keys[slot] == EMPTY_KEY) {
+            return;
+        }
+        auto dense_index = indices[slot];
+
+        // backward-shift deletion, so that no tombstones are needed
+        auto mask = keys.size() - 1;
+        auto hole = slot;
+        auto next = (hole + 1) & mask;
+        while (keys[next] != EMPTY_KEY) {
+            auto home = size_t(hash_key(keys[next])) & mask;
+            if (((next - home) & mask) >= ((next - hole) & mask)) {
+                keys[hole] = keys[next];
+                indices[hole] = indices[next];
+                hole = next;
+            }
+            next = (next + 1) & mask;
+        }
+        keys[hole] = EMPTY_KEY;
+        --entry_count;
+
+        if (is_uniform_index(dense_index)) {
+            return;
+        }
+
+        // swap-remove from the dense list and re-point the moved chunk
+        if (dense_index != live_chunks.size() - 1) {
+            auto &moved = live_chunks.back();
+            auto moved_slot = find_slot(pack_key(moved->chunk_i.x, moved->chunk_i.y, moved->chunk_i.z, moved->level));
+            indices[moved_slot] = dense_index;
+            moved->directory_index = dense_index;
+            live_chunks[dense_index] = std::move(moved);
+        }
+        live_chunks.pop_back();
+    }
+};
+
+enum ChunkDirtyFlags : uint32_t {
+    // The bitmasks changed, so generate_chunk2 needs to be re-run
+    CHUNK_DIRTY_BRICKS = 1 << 0,
+    // Only the surface brick data changed, so it just needs to be re-uploaded
+    CHUNK_DIRTY_RENDER = 1 << 1,
+};
+
+// Lock-free multi-producer, single-consumer queue of dirty chunks. It's an intrusive list
+// threaded through Chunk::next_dirty, and a chunk is only pushed by whoever sets its first
+// dirty flag, so each chunk is in the queue at most once. voxel_world::update is the only
+// consumer, and takes the whole list at once.
+struct DirtyChunkQueue {
+    std::atomic<Chunk *> head = nullptr;
+
+    void mark_dirty(Chunk *chunk, uint32_t flags) {
+        auto prev_flags = chunk->dirty_flags.fetch_or(flags, std::memory_order_acq_rel);
+        if (prev_flags != 0) {
+            return;
+        }
+        auto *prev_head = head.load(std::memory_order_relaxed);
+        do {
+            chunk->next_dirty = prev_head;
+        } while (!head.compare_exchange_weak(prev_head, chunk, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    void drain(std::vector<Chunk *> &out) {
+        auto *chunk = head.exchange(nullptr, std::memory_order_acquire);
+        auto first = out.size();
+        // The next pointers must all be read before the flags get cleared by the
+        // consumer, since after that a producer may push the chunk again.
+        while (chunk != nullptr) {
+            out.push_back(chunk);
+            chunk = chunk->next_dirty;
+        }
+        // restore push order
+        std::reverse(out.begin() + ptrdiff_t(first), out.end());
+    }
 };
 
 using Clock = std::chrono::steady_clock;
 
+constexpr int32_t CHUNK_NX = 1024 / VOXEL_CHUNK_SIZE;
+constexpr int32_t CHUNK_NY = 1024 / VOXEL_CHUNK_SIZE;
+constexpr int32_t CHUNK_NZ = 1024 / VOXEL_CHUNK_SIZE;
+constexpr int32_t CHUNK_LEVELS = 5;
+
+// Every level streams in a window of 2 * CHUNK_N chunks per axis around the view position,
+// minus the part that the next finer level already covers. The chunks in view always fit in the
+// renderer's MAX_CHUNK_COUNT, chunks that are waiting to be retired come on top of that.
+static_assert((2 * CHUNK_NX) * (2 * CHUNK_NY) * (2 * CHUNK_NZ) * CHUNK_LEVELS <= MAX_CHUNK_COUNT);
+struct ChunkRequest {
+    glm::ivec3 chunk_i;
+    int32_t level;
+    float priority;
+};
+
+struct ChunkGenerateTask {
+    VoxelWorld *self;
+    std::unique_ptr<Chunk> chunk;
+    Occupancy occupancy;
+    thread_pool::Task task;
+};
+
 struct VoxelWorld {
-    std::array<std::unique_ptr<Chunk>, MAX_CHUNK_COUNT> chunks;
+    ChunkDirectory chunks;
+    DirtyChunkQueue dirty_chunks;
+    std::vector<Chunk *> dirty_chunks_scratch;
+    // Chunks that didn't fit in the previous frame's remesh budget. They keep their dirty
+    // flags, so they aren't in dirty_chunks.
+    std::vector<Chunk *> deferred_dirty_chunks;
+    Clock::duration remesh_budget = std::chrono::milliseconds(4);
+    voxel_world::LodDownsampling lod_downsampling = voxel_world::LodDownsampling::OFF;
+    Clock::duration downsample_budget = std::chrono::milliseconds(4);
+
+    glm::vec3 view_pos = {};
+    std::array<glm::ivec3, CHUNK_LEVELS> view_centers = {};
+    bool has_view_centers = false;
+    bool logged_initial_load = false;
+    // Heap of chunks waiting to be generated, closest first
+    std::vector<ChunkRequest> chunk_requests;
+    // Chunks that were out of view when the view centers last changed, and haven't been retired yet
+    std::vector<glm::ivec4> retire_candidates;
+    // Keys of chunks that are queued or being generated, and how many there are per level
+    std::unordered_set<uint64_t> requested_chunks;
+    std::array<uint32_t, CHUNK_LEVELS> requested_counts = {};
+    std::vector<ChunkGenerateTask *> generate_tasks;
+    // Finished generate tasks, pushed by the thread pool
+    std::mutex generated_chunks_mutex;
+    std::vector<ChunkGenerateTask *> generated_chunks;
+
     Clock::time_point start_time;
     Clock::time_point prev_time;
 
     std::thread test_chunk_thread;
     bool launch_update;
 
+    // Densities of surface brick candidates, from generate_chunk to generate_chunk2
+    DensityCache density_cache;
+
     std::atomic_uint64_t generate_chunk1s_total;
     std::atomic_uint64_t generate_chunk2s_total;
 
@@ -111,13 +498,6 @@ const auto RANDOM_VALUES = []() {
     return result;
 }();
 
-constexpr int32_t CHUNK_NX = 1024 / VOXEL_CHUNK_SIZE;
-constexpr int32_t CHUNK_NY = 1024 / VOXEL_CHUNK_SIZE;
-constexpr int32_t CHUNK_NZ = 1024 / VOXEL_CHUNK_SIZE;
-constexpr int32_t CHUNK_LEVELS = 5;
-
-static_assert(CHUNK_NX * CHUNK_NY * CHUNK_NZ * 2 * 2 * 2 * CHUNK_LEVELS <= MAX_CHUNK_COUNT);
-
 NoiseSettings noise_settings{
     .persistence = 0.15f,
     .lacunarity = 4.5f,
@@ -125,22 +505,127 @@ NoiseSettings noise_settings{
     .amplitude = 30.0f,
     .octaves = 5,
 };
+// Terrain that all generation evaluates. Rebuild it after changing noise_settings.
+GeneratorProgram generator = make_terrain_generator(noise_settings);
 
-size_t get_chunk_index(int32_t chunk_xi, int32_t chunk_yi, int32_t chunk_zi, int32_t level) {
-    return size_t(chunk_xi + CHUNK_NX) + size_t(chunk_yi + CHUNK_NY) * (CHUNK_NX * 2) + size_t(chunk_zi + CHUNK_NZ) * CHUNK_NX * CHUNK_NY * 2 * 2 + level * CHUNK_NX * CHUNK_NY * CHUNK_NZ * 2 * 2 * 2;
+auto get_brick_metadata(VoxelBrickBitmask const &bitmask) -> BrickMetadata const & {
+    return *reinterpret_cast<BrickMetadata const *>(&bitmask.metadata);
+}
+auto get_brick_metadata(Chunk *chunk, auto brick_index) -> BrickMetadata & {
+    return *reinterpret_cast<BrickMetadata *>(&chunk->brick_bitmasks[chunk->bricks[brick_index]].metadata);
+}
+
+auto make_air_brick_bitmask() -> VoxelBrickBitmask {
+    auto result = VoxelBrickBitmask{};
+    auto &metadata = *reinterpret_cast<BrickMetadata *>(&result.metadata);
+    metadata.has_air_nx = true;
+    metadata.has_air_ny = true;
+    metadata.has_air_nz = true;
+    metadata.has_air_px = true;
+    metadata.has_air_py = true;
+    metadata.has_air_pz = true;
+    return result;
+}
+auto make_solid_brick_bitmask() -> VoxelBrickBitmask {
+    auto result = VoxelBrickBitmask{};
+    for (auto &word : result.bits) {
+        word = ~0u;
+    }
+    reinterpret_cast<BrickMetadata *>(&result.metadata)->has_voxel = true;
+    return result;
 }
 
-auto get_brick_metadata(std::unique_ptr<Chunk> &chunk, auto brick_index) -> BrickMetadata & {
-    return *reinterpret_cast<BrickMetadata *>(&chunk->bricks[brick_index]->bitmask.metadata);
+static VoxelBrickBitmask const AIR_BRICK_BITMASK = make_air_brick_bitmask();
+static VoxelBrickBitmask const SOLID_BRICK_BITMASK = make_solid_brick_bitmask();
+
+// Returns nullptr for solid bricks, which the surface extraction below treats as all ones.
+auto get_neighbor_bitmask(Chunk const *chunk, int brick_index) -> VoxelBrickBitmask const * {
+    auto slot = chunk->bricks[brick_index];
+    switch (get_brick_occupancy(slot)) {
+    case OCCUPANCY_AIR: return &AIR_BRICK_BITMASK;
+    case OCCUPANCY_SOLID: return nullptr;
+    default: return &chunk->brick_bitmasks[slot];
+    }
+}
+// Neighbors that haven't been generated yet are treated as solid, so nothing is exposed towards them.
+auto get_neighbor_bitmask(ChunkLookup const &neighbor_chunk, int brick_index) -> VoxelBrickBitmask const * {
+    if (neighbor_chunk.chunk != nullptr) {
+        return get_neighbor_bitmask(neighbor_chunk.chunk, brick_index);
+    }
+    if (neighbor_chunk.found && neighbor_chunk.occupancy == OCCUPANCY_AIR) {
+        return &AIR_BRICK_BITMASK;
+    }
+    return nullptr;
 }
 
-auto generate_chunk(VoxelWorld *self, int32_t chunk_xi, int32_t chunk_yi, int32_t chunk_zi, int32_t level) {
-    if (level > 0 &&
-        chunk_xi >= -CHUNK_NX / 2 && chunk_xi < CHUNK_NX / 2 &&
-        chunk_yi >= -CHUNK_NY / 2 && chunk_yi < CHUNK_NY / 2 &&
-        chunk_zi >= -CHUNK_NZ / 2 && chunk_zi < CHUNK_NZ / 2) {
-        return;
+static_assert(OCCUPANCY_AIR == 0 && OCCUPANCY_SOLID == 1 && OCCUPANCY_MIXED == 2, "classify_bricks relies on this order");
+
+// Bounds the density over the octants of the chunk, fills the uniform ones in one go and splits the mixed
+// ones into octants again, so that empty space is rejected with a handful of evaluations. Each level of the
+// octree is classified in a single call, which lets the ISPC kernel spread its cubes across lanes.
+void generate_bricks(VoxelWorld *self, Chunk *chunk) {
+    auto level = chunk->level;
+    auto cubes = std::vector<uint32_t>{};
+    auto next_cubes = std::vector<uint32_t>{};
+    auto occupancies = std::vector<uint32_t>{};
+    auto densities = VoxelSimAttribBrick{};
+    auto chunk_key = ChunkDirectory::pack_key(chunk->chunk_i.x, chunk->chunk_i.y, chunk->chunk_i.z, level);
+
+    auto octant_size = BRICK_CHUNK_SIZE / 2;
+    for (uint32_t octant_i = 0; octant_i < 8; ++octant_i) {
+        cubes.push_back(((octant_i & 1) + ((octant_i >> 1) & 1) * BRICK_CHUNK_SIZE + (octant_i >> 2) * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE) * octant_size);
+    }
+
+    for (int32_t size = octant_size; !cubes.empty(); size /= 2) {
+        occupancies.resize(cubes.size());
+        classify_bricks(chunk->chunk_i.x, chunk->chunk_i.y, chunk->chunk_i.z, level, size, int32_t(cubes.size()), cubes.data(), occupancies.data(), &generator, RANDOM_VALUES.data());
+
+        next_cubes.clear();
+        for (size_t cube_i = 0; cube_i < cubes.size(); ++cube_i) {
+            auto brick_index = cubes[cube_i];
+            auto brick_i = glm::ivec3(brick_index % BRICK_CHUNK_SIZE, (brick_index / BRICK_CHUNK_SIZE) % BRICK_CHUNK_SIZE, brick_index / (BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE));
+            if (occupancies[cube_i] != OCCUPANCY_MIXED) {
+                auto uniform_slot = occupancies[cube_i] == OCCUPANCY_SOLID ? BRICK_SOLID : BRICK_AIR;
+                for (int32_t zi = brick_i.z; zi < brick_i.z + size; ++zi) {
+                    for (int32_t yi = brick_i.y; yi < brick_i.y + size; ++yi) {
+                        for (int32_t xi = brick_i.x; xi < brick_i.x + size; ++xi) {
+                            chunk->bricks[xi + yi * BRICK_CHUNK_SIZE + zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE] = uniform_slot;
+                        }
+                    }
+                }
+            } else if (size > 1) {
+                auto half_size = size / 2;
+                for (uint32_t octant_i = 0; octant_i < 8; ++octant_i) {
+                    next_cubes.push_back(brick_index + ((octant_i & 1) + ((octant_i >> 1) & 1) * BRICK_CHUNK_SIZE + (octant_i >> 2) * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE) * half_size);
+                }
+            } else {
+                auto slot = chunk->allocate_brick();
+                chunk->bricks[brick_index] = slot;
+                auto &bitmask = chunk->brick_bitmasks[slot];
+
+                self->generate_chunk1s_total_n += 1;
+                generate_bitmask(brick_i.x, brick_i.y, brick_i.z, chunk->chunk_i.x, chunk->chunk_i.y, chunk->chunk_i.z, level, bitmask.bits, &bitmask.metadata, densities.densities, &generator, RANDOM_VALUES.data());
+
+                // bricks without air on their faces can only become surface bricks through air in their neighbors
+                auto const &metadata = get_brick_metadata(bitmask);
+                if (metadata.has_voxel && (metadata.has_air_nx || metadata.has_air_ny || metadata.has_air_nz || metadata.has_air_px || metadata.has_air_py || metadata.has_air_pz)) {
+                    self->density_cache.insert(chunk_key, brick_index, densities.densities);
+                }
+            }
+        }
+        std::swap(cubes, next_cubes);
     }
+}
+
+// Generates the bitmasks of a chunk that isn't in the directory yet, so any thread can run it.
+// Uniform chunks just get filled with their uniform brick.
+auto generate_chunk(VoxelWorld *self, Chunk *chunk) -> Occupancy {
+    auto chunk_xi = chunk->chunk_i.x;
+    auto chunk_yi = chunk->chunk_i.y;
+    auto chunk_zi = chunk->chunk_i.z;
+    auto level = chunk->level;
+
+    chunk->generation_stage = GENERATED_BITMASK;
 
     {
         auto p0 = glm::vec3{
@@ -149,353 +634,211 @@ auto generate_chunk(VoxelWorld *self, int32_t chunk_xi, int32_t chunk_yi, int32_
             (float((chunk_zi * VOXEL_CHUNK_SIZE) << level) + 0.5f) * VOXEL_SIZE,
         };
         auto p1 = p0 + (BRICK_CHUNK_SIZE * VOXEL_BRICK_SIZE << level) * VOXEL_SIZE;
-        auto minmax = voxel_minmax_value_cpp(&noise_settings, RANDOM_VALUES.data(), p0.x, p0.y, p0.z, p1.x, p1.y, p1.z);
+        auto minmax = generator_minmax_cpp(&generator, RANDOM_VALUES.data(), p0.x, p0.y, p0.z, p1.x, p1.y, p1.z);
         if (minmax.min >= 0.0f || minmax.max < 0.0f) {
             // uniform
-            if (minmax.min < 0.0f) {
-                // inside
-            } else {
-                // outside
-                return;
-            }
+            auto occupancy = minmax.min < 0.0f ? OCCUPANCY_SOLID : OCCUPANCY_AIR;
+            chunk->free_bricks(occupancy == OCCUPANCY_SOLID ? BRICK_SOLID : BRICK_AIR);
+            return occupancy;
         }
     }
 
-    auto chunk_index = get_chunk_index(chunk_xi, chunk_yi, chunk_zi, level);
-    auto &chunk = self->chunks[chunk_index];
-    chunk = std::make_unique<Chunk>();
-    chunk->pos = {chunk_xi, chunk_yi, chunk_zi};
+    chunk->free_bricks();
 
     auto t0 = Clock::now();
 
-    for (int32_t brick_zi = 0; brick_zi < BRICK_CHUNK_SIZE; ++brick_zi) {
-        for (int32_t brick_yi = 0; brick_yi < BRICK_CHUNK_SIZE; ++brick_yi) {
-            for (int32_t brick_xi = 0; brick_xi < BRICK_CHUNK_SIZE; ++brick_xi) {
-                auto brick_index = brick_xi + brick_yi * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
-                auto &brick = chunk->bricks[brick_index];
-                brick = std::make_unique<Brick>();
-                auto &brick_metadata = get_brick_metadata(chunk, brick_index);
-                auto &bitmask = brick->bitmask;
+    generate_bricks(self, chunk);
 
-                brick_metadata = {};
-                bitmask = {};
+    auto t1 = Clock::now();
 
-                // determine if brick is uniform
+    self->generate_chunk1s_total += (t1 - t0).count();
+    return OCCUPANCY_MIXED;
+}
 
-                {
-                    auto p0 = glm::vec3{
-                        (float((brick_xi * VOXEL_BRICK_SIZE + chunk_xi * VOXEL_CHUNK_SIZE) << level) + 0.5f) * VOXEL_SIZE,
-                        (float((brick_yi * VOXEL_BRICK_SIZE + chunk_yi * VOXEL_CHUNK_SIZE) << level) + 0.5f) * VOXEL_SIZE,
-                        (float((brick_zi * VOXEL_BRICK_SIZE + chunk_zi * VOXEL_CHUNK_SIZE) << level) + 0.5f) * VOXEL_SIZE,
-                    };
-                    auto p1 = p0 + (VOXEL_BRICK_SIZE << level) * VOXEL_SIZE;
-                    auto minmax = voxel_minmax_value_cpp(&noise_settings, RANDOM_VALUES.data(), p0.x, p0.y, p0.z, p1.x, p1.y, p1.z);
-                    if (minmax.min >= 0.0f || minmax.max < 0.0f) {
-                        // uniform
-                        brick.reset();
-                        continue;
-                    }
-                }
+// Takes over the generated bricks wherever chunk has no mixed brick of its own. Those only exist
+// if chunk got edited before it was generated, and the edits have to win.
+void adopt_bricks(Chunk *chunk, Chunk *generated) {
+    for (int brick_index = 0; brick_index < BRICKS_PER_CHUNK; ++brick_index) {
+        if (is_mixed_brick(chunk->bricks[brick_index])) {
+            continue;
+        }
+        auto generated_slot = generated->bricks[brick_index];
+        if (!is_mixed_brick(generated_slot)) {
+            chunk->bricks[brick_index] = generated_slot;
+            continue;
+        }
+        auto slot = chunk->allocate_brick();
+        chunk->bricks[brick_index] = slot;
+        chunk->brick_bitmasks[slot] = generated->brick_bitmasks[generated_slot];
+        std::swap(chunk->brick_render_attribs[slot], generated->brick_render_attribs[generated_slot]);
+        std::swap(chunk->brick_sim_attribs[slot], generated->brick_sim_attribs[generated_slot]);
+    }
+    chunk->generation_stage = GENERATED_BITMASK;
+}
 
-                self->generate_chunk1s_total_n += 1;
-                generate_bitmask(brick_xi, brick_yi, brick_zi, chunk_xi, chunk_yi, chunk_zi, level, bitmask.bits, &bitmask.metadata, &noise_settings, RANDOM_VALUES.data());
+// In the face order of generate_neighbor_bits: -x, -y, -z, +x, +y, +z
+constexpr auto NEIGHBOR_OFFSETS = std::array{
+    glm::ivec3(-1, 0, 0),
+    glm::ivec3(0, -1, 0),
+    glm::ivec3(0, 0, -1),
+    glm::ivec3(+1, 0, 0),
+    glm::ivec3(0, +1, 0),
+    glm::ivec3(0, 0, +1),
+};
+
+// Tells the neighbors of a chunk that it's settled. Neighbors that were waiting on it run generate_chunk2
+// once they aren't waiting on anything else, and the others only re-run it if the chunk actually changed.
+void notify_neighbor_chunks(VoxelWorld *self, glm::ivec3 chunk_i, int32_t level, bool changed) {
+    for (uint32_t face_i = 0; face_i < 6; ++face_i) {
+        auto n_chunk_i = chunk_i + NEIGHBOR_OFFSETS[face_i];
+        auto *n_chunk = self->chunks.find(n_chunk_i.x, n_chunk_i.y, n_chunk_i.z, level);
+        if (n_chunk == nullptr) {
+            continue;
+        }
+        // the neighbor sees this chunk on the opposite face
+        auto face_bit = uint8_t(1 << ((face_i + 3) % 6));
+        if ((n_chunk->pending_neighbors & face_bit) != 0) {
+            n_chunk->pending_neighbors &= ~face_bit;
+            if (n_chunk->pending_neighbors == 0) {
+                self->dirty_chunks.mark_dirty(n_chunk, CHUNK_DIRTY_BRICKS);
             }
+        } else if (changed) {
+            self->dirty_chunks.mark_dirty(n_chunk, CHUNK_DIRTY_BRICKS);
         }
     }
+}
 
-    auto t1 = Clock::now();
+// Puts a chunk from generate_chunk into the directory. Its generate_chunk2 waits until none of
+// its neighbors are still queued for generation, so that it runs once instead of once per neighbor.
+void publish_chunk(VoxelWorld *self, std::unique_ptr<Chunk> generated, Occupancy occupancy) {
+    auto chunk_i = generated->chunk_i;
+    auto level = generated->level;
+    auto *chunk = self->chunks.find(chunk_i.x, chunk_i.y, chunk_i.z, level);
+    if (chunk != nullptr) {
+        if (chunk->generation_stage != NOT_GENERATED) {
+            chunk->free_bricks();
+        }
+        adopt_bricks(chunk, generated.get());
+    } else if (occupancy == OCCUPANCY_MIXED) {
+        chunk = self->chunks.insert(std::move(generated));
+    } else {
+        self->chunks.set_uniform(chunk_i.x, chunk_i.y, chunk_i.z, level, occupancy);
+    }
 
-    self->generate_chunk1s_total += (t1 - t0).count();
+    if (chunk != nullptr) {
+        chunk->pending_neighbors = 0;
+        for (uint32_t face_i = 0; face_i < 6; ++face_i) {
+            auto n_chunk_i = chunk_i + NEIGHBOR_OFFSETS[face_i];
+            if (self->requested_chunks.contains(ChunkDirectory::pack_key(n_chunk_i.x, n_chunk_i.y, n_chunk_i.z, level))) {
+                chunk->pending_neighbors |= uint8_t(1 << face_i);
+            }
+        }
+        if (chunk->pending_neighbors == 0) {
+            self->dirty_chunks.mark_dirty(chunk, CHUNK_DIRTY_BRICKS);
+        }
+    }
+    notify_neighbor_chunks(self, chunk_i, level, true);
+}
+
+void generate_chunk(VoxelWorld *self, int32_t chunk_xi, int32_t chunk_yi, int32_t chunk_zi, int32_t level) {
+    auto chunk = make_chunk({chunk_xi, chunk_yi, chunk_zi}, level);
+    auto occupancy = generate_chunk(self, chunk.get());
+    publish_chunk(self, std::move(chunk), occupancy);
 }
 
 auto generate_chunk2(VoxelWorld *self, int32_t chunk_xi, int32_t chunk_yi, int32_t chunk_zi, int32_t level, bool update = true) {
-    auto chunk_index = get_chunk_index(chunk_xi, chunk_yi, chunk_zi, level);
-    auto &chunk = self->chunks[chunk_index];
-    if (!chunk) {
+    auto *chunk = self->chunks.find(chunk_xi, chunk_yi, chunk_zi, level);
+    if (chunk == nullptr) {
         return;
     }
 
     auto t0 = Clock::now();
 
+    auto neighbor_chunk_nx = self->chunks.lookup(chunk_xi - 1, chunk_yi, chunk_zi, level);
+    auto neighbor_chunk_px = self->chunks.lookup(chunk_xi + 1, chunk_yi, chunk_zi, level);
+    auto neighbor_chunk_ny = self->chunks.lookup(chunk_xi, chunk_yi - 1, chunk_zi, level);
+    auto neighbor_chunk_py = self->chunks.lookup(chunk_xi, chunk_yi + 1, chunk_zi, level);
+    auto neighbor_chunk_nz = self->chunks.lookup(chunk_xi, chunk_yi, chunk_zi - 1, level);
+    auto neighbor_chunk_pz = self->chunks.lookup(chunk_xi, chunk_yi, chunk_zi + 1, level);
+
     chunk->surface_brick_indices.clear();
+    chunk->surface_bitmasks.clear();
+    chunk->surface_pos_scls.clear();
+    chunk->surface_render_attribs.clear();
 
     auto temp_sim_attrib_brick = VoxelSimAttribBrick{};
+    auto density_tile = DensityTile{};
+    auto chunk_key = ChunkDirectory::pack_key(chunk_xi, chunk_yi, chunk_zi, level);
 
     for (int32_t brick_zi = 0; brick_zi < BRICK_CHUNK_SIZE; ++brick_zi) {
         for (int32_t brick_yi = 0; brick_yi < BRICK_CHUNK_SIZE; ++brick_yi) {
             for (int32_t brick_xi = 0; brick_xi < BRICK_CHUNK_SIZE; ++brick_xi) {
                 auto brick_index = brick_xi + brick_yi * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
-                if (!chunk->bricks[brick_index])
+                if (!is_mixed_brick(chunk->bricks[brick_index]))
                     continue;
-                auto &brick_metadata = get_brick_metadata(chunk, brick_index);
-                auto &bitmask = chunk->bricks[brick_index]->bitmask;
-
-                brick_metadata.exposed_nx = false;
-                brick_metadata.exposed_px = false;
-                brick_metadata.exposed_ny = false;
-                brick_metadata.exposed_py = false;
-                brick_metadata.exposed_nz = false;
-                brick_metadata.exposed_pz = false;
-
-                auto const *neighbor_bitmask_nx = (VoxelBrickBitmask const *)nullptr;
-                auto const *neighbor_bitmask_px = (VoxelBrickBitmask const *)nullptr;
-                auto const *neighbor_bitmask_ny = (VoxelBrickBitmask const *)nullptr;
-                auto const *neighbor_bitmask_py = (VoxelBrickBitmask const *)nullptr;
-                auto const *neighbor_bitmask_nz = (VoxelBrickBitmask const *)nullptr;
-                auto const *neighbor_bitmask_pz = (VoxelBrickBitmask const *)nullptr;
-
-                if (brick_xi != 0) {
-                    auto neighbor_brick_index = (brick_xi - 1) + brick_yi * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
-                    if (chunk->bricks[neighbor_brick_index]) {
-                        auto &neighbor_brick_metadata = get_brick_metadata(chunk, neighbor_brick_index);
-                        brick_metadata.exposed_nx = neighbor_brick_metadata.has_air_px;
-                        neighbor_bitmask_nx = &chunk->bricks[neighbor_brick_index]->bitmask;
-                    }
-                } else if (chunk_xi != -CHUNK_NX) {
-                    auto neighbor_chunk_index = get_chunk_index(chunk_xi - 1, chunk_yi, chunk_zi, level);
-                    auto &neighbor_chunk = self->chunks[neighbor_chunk_index];
-                    if (neighbor_chunk) {
-                        auto neighbor_brick_index = (BRICK_CHUNK_SIZE - 1) + brick_yi * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
-                        if (neighbor_chunk->bricks[neighbor_brick_index]) {
-                            auto &neighbor_brick_metadata = get_brick_metadata(neighbor_chunk, neighbor_brick_index);
-                            brick_metadata.exposed_nx = neighbor_brick_metadata.has_air_px;
-                            neighbor_bitmask_nx = &neighbor_chunk->bricks[neighbor_brick_index]->bitmask;
-                        }
-                    } else {
-                        // brick_metadata.exposed_nx = true;
-                    }
-                }
-                if (brick_yi != 0) {
-                    auto neighbor_brick_index = brick_xi + (brick_yi - 1) * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
-                    if (chunk->bricks[neighbor_brick_index]) {
-                        auto &neighbor_brick_metadata = get_brick_metadata(chunk, neighbor_brick_index);
-                        brick_metadata.exposed_ny = neighbor_brick_metadata.has_air_py;
-                        neighbor_bitmask_ny = &chunk->bricks[neighbor_brick_index]->bitmask;
-                    }
-                } else if (chunk_yi != -CHUNK_NY) {
-                    auto neighbor_chunk_index = get_chunk_index(chunk_xi, chunk_yi - 1, chunk_zi, level);
-                    auto &neighbor_chunk = self->chunks[neighbor_chunk_index];
-                    if (neighbor_chunk) {
-                        auto neighbor_brick_index = brick_xi + (BRICK_CHUNK_SIZE - 1) * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
-                        if (neighbor_chunk->bricks[neighbor_brick_index]) {
-                            auto &neighbor_brick_metadata = get_brick_metadata(neighbor_chunk, neighbor_brick_index);
-                            brick_metadata.exposed_ny = neighbor_brick_metadata.has_air_py;
-                            neighbor_bitmask_ny = &neighbor_chunk->bricks[neighbor_brick_index]->bitmask;
-                        }
-                    } else {
-                        // brick_metadata.exposed_ny = true;
-                    }
-                }
-                if (brick_zi != 0) {
-                    auto neighbor_brick_index = brick_xi + brick_yi * BRICK_CHUNK_SIZE + (brick_zi - 1) * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
-                    if (chunk->bricks[neighbor_brick_index]) {
-                        auto &neighbor_brick_metadata = get_brick_metadata(chunk, neighbor_brick_index);
-                        brick_metadata.exposed_nz = neighbor_brick_metadata.has_air_pz;
-                        neighbor_bitmask_nz = &chunk->bricks[neighbor_brick_index]->bitmask;
-                    }
-                } else if (chunk_zi != -CHUNK_NZ) {
-                    auto neighbor_chunk_index = get_chunk_index(chunk_xi, chunk_yi, chunk_zi - 1, level);
-                    auto &neighbor_chunk = self->chunks[neighbor_chunk_index];
-                    if (neighbor_chunk) {
-                        auto neighbor_brick_index = brick_xi + brick_yi * BRICK_CHUNK_SIZE + (BRICK_CHUNK_SIZE - 1) * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
-                        if (neighbor_chunk->bricks[neighbor_brick_index]) {
-                            auto &neighbor_brick_metadata = get_brick_metadata(neighbor_chunk, neighbor_brick_index);
-                            brick_metadata.exposed_nz = neighbor_brick_metadata.has_air_pz;
-                            neighbor_bitmask_nz = &neighbor_chunk->bricks[neighbor_brick_index]->bitmask;
-                        }
-                    } else {
-                        // brick_metadata.exposed_nz = true;
-                    }
-                }
-                if (brick_xi != BRICK_CHUNK_SIZE - 1) {
-                    auto neighbor_brick_index = (brick_xi + 1) + brick_yi * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
-                    if (chunk->bricks[neighbor_brick_index]) {
-                        auto &neighbor_brick_metadata = get_brick_metadata(chunk, neighbor_brick_index);
-                        brick_metadata.exposed_px = neighbor_brick_metadata.has_air_nx;
-                        neighbor_bitmask_px = &chunk->bricks[neighbor_brick_index]->bitmask;
-                    }
-                } else if (chunk_xi != CHUNK_NX - 1) {
-                    auto neighbor_chunk_index = get_chunk_index(chunk_xi + 1, chunk_yi, chunk_zi, level);
-                    auto &neighbor_chunk = self->chunks[neighbor_chunk_index];
-                    if (neighbor_chunk) {
-                        auto neighbor_brick_index = 0 + brick_yi * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
-                        if (neighbor_chunk->bricks[neighbor_brick_index]) {
-                            auto &neighbor_brick_metadata = get_brick_metadata(neighbor_chunk, neighbor_brick_index);
-                            brick_metadata.exposed_px = neighbor_brick_metadata.has_air_nx;
-                            neighbor_bitmask_px = &neighbor_chunk->bricks[neighbor_brick_index]->bitmask;
-                        }
-                    } else {
-                        // brick_metadata.exposed_px = true;
-                    }
-                }
-                if (brick_yi != BRICK_CHUNK_SIZE - 1) {
-                    auto neighbor_brick_index = brick_xi + (brick_yi + 1) * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
-                    if (chunk->bricks[neighbor_brick_index]) {
-                        auto &neighbor_brick_metadata = get_brick_metadata(chunk, neighbor_brick_index);
-                        brick_metadata.exposed_py = neighbor_brick_metadata.has_air_ny;
-                        neighbor_bitmask_py = &chunk->bricks[neighbor_brick_index]->bitmask;
-                    }
-                } else if (chunk_yi != CHUNK_NY - 1) {
-                    auto neighbor_chunk_index = get_chunk_index(chunk_xi, chunk_yi + 1, chunk_zi, level);
-                    auto &neighbor_chunk = self->chunks[neighbor_chunk_index];
-                    if (neighbor_chunk) {
-                        auto neighbor_brick_index = brick_xi + 0 * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
-                        if (neighbor_chunk->bricks[neighbor_brick_index]) {
-                            auto &neighbor_brick_metadata = get_brick_metadata(neighbor_chunk, neighbor_brick_index);
-                            brick_metadata.exposed_py = neighbor_brick_metadata.has_air_ny;
-                            neighbor_bitmask_py = &neighbor_chunk->bricks[neighbor_brick_index]->bitmask;
-                        }
-                    } else {
-                        // brick_metadata.exposed_py = true;
-                    }
-                }
-                if (brick_zi != BRICK_CHUNK_SIZE - 1) {
-                    auto neighbor_brick_index = brick_xi + brick_yi * BRICK_CHUNK_SIZE + (brick_zi + 1) * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
-                    if (chunk->bricks[neighbor_brick_index]) {
-                        auto &neighbor_brick_metadata = get_brick_metadata(chunk, neighbor_brick_index);
-                        brick_metadata.exposed_pz = neighbor_brick_metadata.has_air_nz;
-                        neighbor_bitmask_pz = &chunk->bricks[neighbor_brick_index]->bitmask;
-                    }
-                } else if (chunk_zi != CHUNK_NZ - 1) {
-                    auto neighbor_chunk_index = get_chunk_index(chunk_xi, chunk_yi, chunk_zi + 1, level);
-                    auto &neighbor_chunk = self->chunks[neighbor_chunk_index];
-                    if (neighbor_chunk) {
-                        auto neighbor_brick_index = brick_xi + brick_yi * BRICK_CHUNK_SIZE + 0 * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
-                        if (neighbor_chunk->bricks[neighbor_brick_index]) {
-                            auto &neighbor_brick_metadata = get_brick_metadata(neighbor_chunk, neighbor_brick_index);
-                            brick_metadata.exposed_pz = neighbor_brick_metadata.has_air_nz;
-                            neighbor_bitmask_pz = &neighbor_chunk->bricks[neighbor_brick_index]->bitmask;
-                        }
-                    } else {
-                        // brick_metadata.exposed_pz = true;
-                    }
-                }
-
-                bool exposed = brick_metadata.exposed_nx || brick_metadata.exposed_px || brick_metadata.exposed_ny || brick_metadata.exposed_py || brick_metadata.exposed_nz || brick_metadata.exposed_pz;
+                auto const &brick_metadata = get_brick_metadata(chunk, brick_index);
+                auto slot = chunk->bricks[brick_index];
+                auto const &bitmask = chunk->brick_bitmasks[slot];
+
+                auto const *neighbor_bitmask_nx = brick_xi != 0 ? get_neighbor_bitmask(chunk, (brick_xi - 1) + brick_yi * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE) : get_neighbor_bitmask(neighbor_chunk_nx, (BRICK_CHUNK_SIZE - 1) + brick_yi * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE);
+                auto const *neighbor_bitmask_ny = brick_yi != 0 ? get_neighbor_bitmask(chunk, brick_xi + (brick_yi - 1) * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE) : get_neighbor_bitmask(neighbor_chunk_ny, brick_xi + (BRICK_CHUNK_SIZE - 1) * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE);
+                auto const *neighbor_bitmask_nz = brick_zi != 0 ? get_neighbor_bitmask(chunk, brick_xi + brick_yi * BRICK_CHUNK_SIZE + (brick_zi - 1) * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE) : get_neighbor_bitmask(neighbor_chunk_nz, brick_xi + brick_yi * BRICK_CHUNK_SIZE + (BRICK_CHUNK_SIZE - 1) * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE);
+                auto const *neighbor_bitmask_px = brick_xi != BRICK_CHUNK_SIZE - 1 ? get_neighbor_bitmask(chunk, (brick_xi + 1) + brick_yi * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE) : get_neighbor_bitmask(neighbor_chunk_px, 0 + brick_yi * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE);
+                auto const *neighbor_bitmask_py = brick_yi != BRICK_CHUNK_SIZE - 1 ? get_neighbor_bitmask(chunk, brick_xi + (brick_yi + 1) * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE) : get_neighbor_bitmask(neighbor_chunk_py, brick_xi + 0 * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE);
+                auto const *neighbor_bitmask_pz = brick_zi != BRICK_CHUNK_SIZE - 1 ? get_neighbor_bitmask(chunk, brick_xi + brick_yi * BRICK_CHUNK_SIZE + (brick_zi + 1) * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE) : get_neighbor_bitmask(neighbor_chunk_pz, brick_xi + brick_yi * BRICK_CHUNK_SIZE + 0 * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE);
+
+                // solid neighbors come back as nullptr, and never expose anything
+                auto exposed_nx = neighbor_bitmask_nx != nullptr && get_brick_metadata(*neighbor_bitmask_nx).has_air_px;
+                auto exposed_ny = neighbor_bitmask_ny != nullptr && get_brick_metadata(*neighbor_bitmask_ny).has_air_py;
+                auto exposed_nz = neighbor_bitmask_nz != nullptr && get_brick_metadata(*neighbor_bitmask_nz).has_air_pz;
+                auto exposed_px = neighbor_bitmask_px != nullptr && get_brick_metadata(*neighbor_bitmask_px).has_air_nx;
+                auto exposed_py = neighbor_bitmask_py != nullptr && get_brick_metadata(*neighbor_bitmask_py).has_air_ny;
+                auto exposed_pz = neighbor_bitmask_pz != nullptr && get_brick_metadata(*neighbor_bitmask_pz).has_air_nz;
+
+                bool exposed = exposed_nx || exposed_px || exposed_ny || exposed_py || exposed_nz || exposed_pz;
 
                 auto position = glm::ivec4{brick_xi, brick_yi, brick_zi, -LOG2_VOXELS_PER_METER + level};
                 if (brick_metadata.has_voxel && exposed) {
                     // generate surface brick data
-                    auto &render_attrib_brick = chunk->bricks[brick_index]->render_attribs;
-                    auto &sim_attrib_brick = chunk->bricks[brick_index]->sim_attribs;
                     self->generate_chunk2s_total_n += 1;
 
-                    if (render_attrib_brick == nullptr) {
-                        render_attrib_brick = std::make_unique<VoxelRenderAttribBrick>();
+                    if (chunk->brick_render_attribs[slot] == INVALID_RENDER_ATTRIBS) {
+                        chunk->brick_render_attribs[slot] = s_render_attrib_pool.allocate();
                         auto sim_attrib_brick_ptr = (VoxelSimAttribBrick *)nullptr;
                         if (level == 0) {
-                            sim_attrib_brick = std::make_unique<VoxelSimAttribBrick>();
-                            sim_attrib_brick_ptr = sim_attrib_brick.get();
+                            chunk->brick_sim_attribs[slot] = s_sim_attrib_pool.allocate();
+                            sim_attrib_brick_ptr = chunk->get_sim_attribs(slot);
                         } else {
                             sim_attrib_brick_ptr = &temp_sim_attrib_brick;
                         }
-                        generate_attributes(brick_xi, brick_yi, brick_zi, chunk_xi, chunk_yi, chunk_zi, level, (uint32_t *)render_attrib_brick->packed_voxels, (float *)sim_attrib_brick_ptr->densities, &noise_settings, RANDOM_VALUES.data());
+                        auto densities_known = self->density_cache.take(chunk_key, brick_index, sim_attrib_brick_ptr->densities);
+                        generate_density_tile(brick_xi, brick_yi, brick_zi, chunk_xi, chunk_yi, chunk_zi, level, density_tile.densities, sim_attrib_brick_ptr->densities, densities_known, &generator, RANDOM_VALUES.data());
+                        generate_attributes((uint32_t *)chunk->get_render_attribs(slot)->packed_voxels, (float *)sim_attrib_brick_ptr->densities, density_tile.densities, RANDOM_VALUES.data());
                     }
 
-                    auto get_brick_bit = [](VoxelBrickBitmask const &bitmask, uint32_t xi, uint32_t yi, uint32_t zi) {
-                        uint32_t voxel_index = xi + yi * VOXEL_BRICK_SIZE + zi * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE;
-                        uint32_t voxel_word_index = voxel_index / 32;
-                        uint32_t voxel_in_word_index = voxel_index % 32;
-                        return (bitmask.bits[voxel_word_index] >> voxel_in_word_index) & 1;
+                    uint32_t const *const neighbor_brick_bits[6] = {
+                        neighbor_bitmask_nx != nullptr ? neighbor_bitmask_nx->bits : nullptr,
+                        neighbor_bitmask_ny != nullptr ? neighbor_bitmask_ny->bits : nullptr,
+                        neighbor_bitmask_nz != nullptr ? neighbor_bitmask_nz->bits : nullptr,
+                        neighbor_bitmask_px != nullptr ? neighbor_bitmask_px->bits : nullptr,
+                        neighbor_bitmask_py != nullptr ? neighbor_bitmask_py->bits : nullptr,
+                        neighbor_bitmask_pz != nullptr ? neighbor_bitmask_pz->bits : nullptr,
                     };
-                    auto set_brick_neighbor_bit = [](VoxelBrickBitmask &bitmask, uint32_t xi, uint32_t yi, uint32_t fi, uint32_t value) {
-                        uint32_t voxel_index = xi + yi * VOXEL_BRICK_SIZE + fi * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE;
-                        uint32_t voxel_word_index = voxel_index / 32;
-                        uint32_t voxel_in_word_index = voxel_index % 32;
-                        if (value != 0) {
-                            bitmask.neighbor_bits[voxel_word_index] |= (1 << voxel_in_word_index);
-                        } else {
-                            // bitmask.neighbor_bits[voxel_word_index] &= ~(1 << voxel_in_word_index);
-                        }
-                    };
-
-                    for (auto &word : bitmask.neighbor_bits) {
-                        word = {};
-                    }
-
-                    if (neighbor_bitmask_nx != nullptr) {
-                        for (uint32_t bi = 0; bi < VOXEL_BRICK_SIZE; ++bi) {
-                            for (uint32_t ai = 0; ai < VOXEL_BRICK_SIZE; ++ai) {
-                                set_brick_neighbor_bit(bitmask, ai, bi, 0, get_brick_bit(*neighbor_bitmask_nx, VOXEL_BRICK_SIZE - 1, ai, bi));
-                            }
-                        }
-                    } else {
-                        for (uint32_t bi = 0; bi < VOXEL_BRICK_SIZE; ++bi) {
-                            for (uint32_t ai = 0; ai < VOXEL_BRICK_SIZE; ++ai) {
-                                set_brick_neighbor_bit(bitmask, ai, bi, 0, 1);
-                            }
-                        }
-                    }
-                    if (neighbor_bitmask_px != nullptr) {
-                        for (uint32_t bi = 0; bi < VOXEL_BRICK_SIZE; ++bi) {
-                            for (uint32_t ai = 0; ai < VOXEL_BRICK_SIZE; ++ai) {
-                                set_brick_neighbor_bit(bitmask, ai, bi, 3, get_brick_bit(*neighbor_bitmask_px, 0, ai, bi));
-                            }
-                        }
-                    } else {
-                        for (uint32_t bi = 0; bi < VOXEL_BRICK_SIZE; ++bi) {
-                            for (uint32_t ai = 0; ai < VOXEL_BRICK_SIZE; ++ai) {
-                                set_brick_neighbor_bit(bitmask, ai, bi, 3, 1);
-                            }
-                        }
-                    }
-
-                    if (neighbor_bitmask_ny != nullptr) {
-                        for (uint32_t bi = 0; bi < VOXEL_BRICK_SIZE; ++bi) {
-                            for (uint32_t ai = 0; ai < VOXEL_BRICK_SIZE; ++ai) {
-                                set_brick_neighbor_bit(bitmask, ai, bi, 1, get_brick_bit(*neighbor_bitmask_ny, ai, VOXEL_BRICK_SIZE - 1, bi));
-                            }
-                        }
-                    } else {
-                        for (uint32_t bi = 0; bi < VOXEL_BRICK_SIZE; ++bi) {
-                            for (uint32_t ai = 0; ai < VOXEL_BRICK_SIZE; ++ai) {
-                                set_brick_neighbor_bit(bitmask, ai, bi, 1, 1);
-                            }
-                        }
-                    }
-                    if (neighbor_bitmask_py != nullptr) {
-                        for (uint32_t bi = 0; bi < VOXEL_BRICK_SIZE; ++bi) {
-                            for (uint32_t ai = 0; ai < VOXEL_BRICK_SIZE; ++ai) {
-                                set_brick_neighbor_bit(bitmask, ai, bi, 4, get_brick_bit(*neighbor_bitmask_py, ai, 0, bi));
-                            }
-                        }
-                    } else {
-                        for (uint32_t bi = 0; bi < VOXEL_BRICK_SIZE; ++bi) {
-                            for (uint32_t ai = 0; ai < VOXEL_BRICK_SIZE; ++ai) {
-                                set_brick_neighbor_bit(bitmask, ai, bi, 4, 1);
-                            }
-                        }
-                    }
-
-                    if (neighbor_bitmask_nz != nullptr) {
-                        for (uint32_t bi = 0; bi < VOXEL_BRICK_SIZE; ++bi) {
-                            for (uint32_t ai = 0; ai < VOXEL_BRICK_SIZE; ++ai) {
-                                set_brick_neighbor_bit(bitmask, ai, bi, 2, get_brick_bit(*neighbor_bitmask_nz, ai, bi, VOXEL_BRICK_SIZE - 1));
-                            }
-                        }
-                    } else {
-                        for (uint32_t bi = 0; bi < VOXEL_BRICK_SIZE; ++bi) {
-                            for (uint32_t ai = 0; ai < VOXEL_BRICK_SIZE; ++ai) {
-                                set_brick_neighbor_bit(bitmask, ai, bi, 2, 1);
-                            }
-                        }
-                    }
-                    if (neighbor_bitmask_pz != nullptr) {
-                        for (uint32_t bi = 0; bi < VOXEL_BRICK_SIZE; ++bi) {
-                            for (uint32_t ai = 0; ai < VOXEL_BRICK_SIZE; ++ai) {
-                                set_brick_neighbor_bit(bitmask, ai, bi, 5, get_brick_bit(*neighbor_bitmask_pz, ai, bi, 0));
-                            }
-                        }
-                    } else {
-                        for (uint32_t bi = 0; bi < VOXEL_BRICK_SIZE; ++bi) {
-                            for (uint32_t ai = 0; ai < VOXEL_BRICK_SIZE; ++ai) {
-                                set_brick_neighbor_bit(bitmask, ai, bi, 5, 1);
-                            }
-                        }
-                    }
+                    // Neighboring chunks read has_air_* out of the stored metadata while they run generate_chunk2 on
+                    // other threads, so the exposure and the neighbor faces only go into the uploaded copy
+                    auto &surface_bitmask = chunk->surface_bitmasks.emplace_back(bitmask);
+                    auto &surface_metadata = *reinterpret_cast<BrickMetadata *>(&surface_bitmask.metadata);
+                    surface_metadata.exposed_nx = exposed_nx;
+                    surface_metadata.exposed_ny = exposed_ny;
+                    surface_metadata.exposed_nz = exposed_nz;
+                    surface_metadata.exposed_px = exposed_px;
+                    surface_metadata.exposed_py = exposed_py;
+                    surface_metadata.exposed_pz = exposed_pz;
+                    generate_neighbor_bits(surface_bitmask.neighbor_bits, neighbor_brick_bits);
 
-                    chunk->bricks[brick_index]->pos_scl = position;
                     chunk->surface_brick_indices.push_back(brick_index);
+                    chunk->surface_pos_scls.push_back(position);
+                    chunk->surface_render_attribs.push_back(chunk->get_render_attribs(slot));
                 }
             }
         }
@@ -505,102 +848,327 @@ auto generate_chunk2(VoxelWorld *self, int32_t chunk_xi, int32_t chunk_yi, int32
     self->generate_chunk2s_total += (t1 - t0).count();
 
     if (update) {
-        chunk->bricks_changed = true;
+        self->dirty_chunks.mark_dirty(chunk, CHUNK_DIRTY_RENDER);
     }
 }
 
-auto generate_all_chunks(VoxelWorld *self) {
-    std::vector<std::pair<thread_pool::Task, void *>> tasks;
-    tasks.reserve(CHUNK_NX * CHUNK_NY * CHUNK_NZ * 2 * 2 * 2 * CHUNK_LEVELS);
+// Snapped to even chunks, so that the window edges of the next finer level line up with this level's chunks.
+auto get_view_center(glm::vec3 view_pos, int32_t level) -> glm::ivec3 {
+    auto chunk_size = float(VOXEL_CHUNK_SIZE << level) * VOXEL_SIZE;
+    auto chunk_i = glm::ivec3(glm::floor(view_pos / chunk_size));
+    return chunk_i & ~1;
+}
 
-    self->generate_chunk1s_total = {};
-    self->generate_chunk2s_total = {};
-    auto generate_chunk1s_main_total_ns = uint64_t{};
-    auto generate_chunk2s_main_total_ns = uint64_t{};
+auto is_chunk_in_window(VoxelWorld const *self, glm::ivec3 chunk_i, int32_t level) -> bool {
+    auto const chunk_n = glm::ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ);
+    auto center = self->view_centers[level];
+    return glm::all(glm::greaterThanEqual(chunk_i, center - chunk_n)) && glm::all(glm::lessThan(chunk_i, center + chunk_n));
+}
 
-    struct GenChunkArgs {
-        VoxelWorld *self;
-        int32_t chunk_xi;
-        int32_t chunk_yi;
-        int32_t chunk_zi;
-        int32_t level;
-        bool update = true;
-    };
+auto is_chunk_covered_by_finer_level(VoxelWorld const *self, glm::ivec3 chunk_i, int32_t level) -> bool {
+    if (level == 0) {
+        return false;
+    }
+    auto const chunk_n = glm::ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ);
+    auto center = self->view_centers[level - 1];
+    return glm::all(glm::greaterThanEqual(chunk_i * 2, center - chunk_n)) && glm::all(glm::lessThanEqual(chunk_i * 2 + 2, center + chunk_n));
+}
 
-    {
-        auto t0 = Clock::now();
-
-        for (int32_t level_i = 0; level_i < CHUNK_LEVELS; ++level_i) {
-            for (int32_t chunk_zi = -CHUNK_NZ; chunk_zi < CHUNK_NZ; ++chunk_zi) {
-                for (int32_t chunk_yi = -CHUNK_NY; chunk_yi < CHUNK_NY; ++chunk_yi) {
-                    for (int32_t chunk_xi = -CHUNK_NX; chunk_xi < CHUNK_NX; ++chunk_xi) {
-                        auto *user_ptr = new GenChunkArgs{self, chunk_xi, chunk_yi, chunk_zi, level_i};
-                        auto task = thread_pool::create_task([](void *user_ptr) { auto const &args = *(GenChunkArgs*)user_ptr; generate_chunk(args.self, args.chunk_xi, args.chunk_yi, args.chunk_zi, args.level); }, user_ptr);
-                        thread_pool::async_dispatch(task);
-                        tasks.emplace_back(task, user_ptr);
+auto is_chunk_in_view(VoxelWorld const *self, glm::ivec3 chunk_i, int32_t level) -> bool {
+    return is_chunk_in_window(self, chunk_i, level) && !is_chunk_covered_by_finer_level(self, chunk_i, level);
+}
+
+// Distance in units of the chunk's own size, so that all levels fill in from the view outwards together.
+auto get_chunk_priority(glm::vec3 view_pos, glm::ivec3 chunk_i, int32_t level) -> float {
+    auto chunk_size = float(VOXEL_CHUNK_SIZE << level) * VOXEL_SIZE;
+    auto chunk_center = (glm::vec3(chunk_i) + 0.5f) * chunk_size;
+    return glm::length(chunk_center - view_pos) / chunk_size;
+}
+
+auto is_lower_priority(ChunkRequest const &a, ChunkRequest const &b) -> bool {
+    return a.priority > b.priority;
+}
+
+// Once the view crosses into another chunk of some level, queues the chunks that came into view
+// and re-prioritizes the queue. Chunks that left the view are retired by retire_chunks.
+void update_view_centers(VoxelWorld *self) {
+    auto view_centers = std::array<glm::ivec3, CHUNK_LEVELS>{};
+    for (int32_t level_i = 0; level_i < CHUNK_LEVELS; ++level_i) {
+        view_centers[level_i] = get_view_center(self->view_pos, level_i);
+    }
+    if (self->has_view_centers && view_centers == self->view_centers) {
+        return;
+    }
+    self->view_centers = view_centers;
+    self->has_view_centers = true;
+
+    // only chunks that are out of view now can be retired until the view moves again
+    self->retire_candidates.clear();
+    for (auto packed_key : self->chunks.keys) {
+        if (packed_key == ChunkDirectory::EMPTY_KEY) {
+            continue;
+        }
+        auto key = ChunkDirectory::unpack_key(packed_key);
+        if (!is_chunk_in_view(self, glm::ivec3(key), key.w)) {
+            self->retire_candidates.push_back(key);
+        }
+    }
+
+    std::erase_if(self->chunk_requests, [self](ChunkRequest const &request) {
+        if (is_chunk_in_view(self, request.chunk_i, request.level)) {
+            return false;
+        }
+        self->requested_chunks.erase(ChunkDirectory::pack_key(request.chunk_i.x, request.chunk_i.y, request.chunk_i.z, request.level));
+        --self->requested_counts[request.level];
+        notify_neighbor_chunks(self, request.chunk_i, request.level, false);
+        return true;
+    });
+    // generate tasks that haven't started yet don't need to run at all
+    std::erase_if(self->generate_tasks, [self](ChunkGenerateTask *args) {
+        auto &chunk = args->chunk;
+        if (is_chunk_in_view(self, chunk->chunk_i, chunk->level) || !thread_pool::cancel(args->task)) {
+            return false;
+        }
+        self->requested_chunks.erase(ChunkDirectory::pack_key(chunk->chunk_i.x, chunk->chunk_i.y, chunk->chunk_i.z, chunk->level));
+        --self->requested_counts[chunk->level];
+        notify_neighbor_chunks(self, chunk->chunk_i, chunk->level, false);
+        thread_pool::destroy_task(args->task);
+        delete args;
+        return true;
+    });
+    for (auto &request : self->chunk_requests) {
+        request.priority = get_chunk_priority(self->view_pos, request.chunk_i, request.level);
+    }
+
+    for (int32_t level_i = 0; level_i < CHUNK_LEVELS; ++level_i) {
+        auto center = self->view_centers[level_i];
+        for (int32_t chunk_zi = center.z - CHUNK_NZ; chunk_zi < center.z + CHUNK_NZ; ++chunk_zi) {
+            for (int32_t chunk_yi = center.y - CHUNK_NY; chunk_yi < center.y + CHUNK_NY; ++chunk_yi) {
+                for (int32_t chunk_xi = center.x - CHUNK_NX; chunk_xi < center.x + CHUNK_NX; ++chunk_xi) {
+                    auto chunk_i = glm::ivec3(chunk_xi, chunk_yi, chunk_zi);
+                    if (is_chunk_covered_by_finer_level(self, chunk_i, level_i)) {
+                        continue;
+                    }
+                    auto key = ChunkDirectory::pack_key(chunk_xi, chunk_yi, chunk_zi, level_i);
+                    if (self->requested_chunks.contains(key)) {
+                        continue;
                     }
+                    // chunks that only exist because they were edited still need to be generated
+                    auto lookup = self->chunks.lookup(chunk_xi, chunk_yi, chunk_zi, level_i);
+                    if (lookup.found && (lookup.chunk == nullptr || lookup.chunk->generation_stage != NOT_GENERATED)) {
+                        continue;
+                    }
+                    self->chunk_requests.push_back({chunk_i, level_i, get_chunk_priority(self->view_pos, chunk_i, level_i)});
+                    self->requested_chunks.insert(key);
+                    ++self->requested_counts[level_i];
                 }
             }
         }
+    }
+    std::make_heap(self->chunk_requests.begin(), self->chunk_requests.end(), is_lower_priority);
+}
+
+auto get_child_chunk_i(glm::ivec3 chunk_i, uint32_t octant_i) -> glm::ivec3 {
+    return chunk_i * 2 + glm::ivec3(octant_i & 1, (octant_i >> 1) & 1, octant_i >> 2);
+}
+
+// A chunk can be downsampled once all 8 chunks of the finer level that it covers are loaded and meshed.
+// Those are only around while the view moves away from them, since retire_chunks keeps them until
+// the chunks replacing them are generated.
+auto can_downsample_chunk(VoxelWorld const *self, glm::ivec3 chunk_i, int32_t level) -> bool {
+    if (self->lod_downsampling == voxel_world::LodDownsampling::OFF || level == 0) {
+        return false;
+    }
+    for (uint32_t octant_i = 0; octant_i < 8; ++octant_i) {
+        auto child_chunk_i = get_child_chunk_i(chunk_i, octant_i);
+        auto child = self->chunks.lookup(child_chunk_i.x, child_chunk_i.y, child_chunk_i.z, level - 1);
+        if (!child.found) {
+            return false;
+        }
+        // the surface attributes are only there after generate_chunk2
+        auto *child_chunk = child.chunk;
+        if (child_chunk != nullptr && (child_chunk->generation_stage == NOT_GENERATED || child_chunk->pending_neighbors != 0 || child_chunk->dirty_flags.load(std::memory_order_relaxed) != 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Defined with the other users of pack_unpack.inl below
+auto downsample_chunk(VoxelWorld *self, Chunk *chunk) -> Occupancy;
+
+// Downsamples chunks on the thread pool and publishes them, in small batches like remesh_dirty_chunks. Once
+// a batch ends past the downsample budget, the remaining requests go back into the queue for the next frame. The
+// finer chunks are read in place, which is fine since nothing else touches the directory's chunks until
+// parallel_for returns.
+void downsample_chunks(VoxelWorld *self, std::vector<ChunkRequest> const &requests) {
+    constexpr size_t DOWNSAMPLE_BATCH_SIZE = 8;
+
+    struct DownsampleChunkArgs {
+        VoxelWorld *self;
+        std::unique_ptr<Chunk> chunk;
+        Occupancy occupancy;
+    };
 
-        for (auto &[task, user_ptr] : tasks) {
-            thread_pool::wait(task);
-            thread_pool::destroy_task(task);
-            delete (GenChunkArgs *)user_ptr;
+    auto t0 = Clock::now();
+    auto batch_args = std::vector<DownsampleChunkArgs>{};
+
+    size_t request_i = 0;
+    while (request_i < requests.size()) {
+        if (request_i != 0 && self->downsample_budget > Clock::duration::zero() && Clock::now() - t0 > self->downsample_budget) {
+            break;
         }
-        tasks.clear();
 
-        auto t1 = Clock::now();
-        generate_chunk1s_main_total_ns += (t1 - t0).count();
+        auto batch_size = std::min(DOWNSAMPLE_BATCH_SIZE, requests.size() - request_i);
+        batch_args.clear();
+        for (size_t i = 0; i < batch_size; ++i) {
+            auto const &request = requests[request_i + i];
+            batch_args.push_back({.self = self, .chunk = make_chunk(request.chunk_i, request.level)});
+        }
+        thread_pool::parallel_for(
+            0, uint32_t(batch_size), 1,
+            [](void *user_ptr, uint32_t index) {
+                auto &args = ((DownsampleChunkArgs *)user_ptr)[index];
+                args.occupancy = downsample_chunk(args.self, args.chunk.get());
+            },
+            batch_args.data(), thread_pool::TaskPriority::HIGH);
+
+        for (auto &args : batch_args) {
+            auto &chunk = args.chunk;
+            self->requested_chunks.erase(ChunkDirectory::pack_key(chunk->chunk_i.x, chunk->chunk_i.y, chunk->chunk_i.z, chunk->level));
+            --self->requested_counts[chunk->level];
+            publish_chunk(self, std::move(chunk), args.occupancy);
+        }
+        request_i += batch_size;
     }
 
-    {
-        auto t0 = Clock::now();
-        for (int32_t level_i = 0; level_i < CHUNK_LEVELS; ++level_i) {
-            for (int32_t chunk_zi = -CHUNK_NZ; chunk_zi < CHUNK_NZ; ++chunk_zi) {
-                for (int32_t chunk_yi = -CHUNK_NY; chunk_yi < CHUNK_NY; ++chunk_yi) {
-                    for (int32_t chunk_xi = -CHUNK_NX; chunk_xi < CHUNK_NX; ++chunk_xi) {
-                        auto *user_ptr = new GenChunkArgs{self, chunk_xi, chunk_yi, chunk_zi, level_i};
-                        auto task = thread_pool::create_task([](void *user_ptr) { auto const &args = *(GenChunkArgs*)user_ptr; generate_chunk2(args.self, args.chunk_xi, args.chunk_yi, args.chunk_zi, args.level); }, user_ptr);
-                        thread_pool::async_dispatch(task);
-                        tasks.emplace_back(task, user_ptr);
-                    }
-                }
+    for (; request_i < requests.size(); ++request_i) {
+        self->chunk_requests.push_back(requests[request_i]);
+        std::push_heap(self->chunk_requests.begin(), self->chunk_requests.end(), is_lower_priority);
+    }
+}
+
+// Keeps half of the thread pool free, so that remeshing doesn't have to queue behind generation. Chunks
+// that can be downsampled don't take a generate task, and are built in one batch at the end instead.
+void dispatch_chunk_requests(VoxelWorld *self) {
+    auto const max_generate_tasks = size_t(std::max(1u, thread_pool::get_worker_count() / 2));
+    constexpr size_t MAX_DOWNSAMPLE_BATCH_SIZE = 32;
+
+    auto downsample_requests = std::vector<ChunkRequest>{};
+    while (!self->chunk_requests.empty()) {
+        auto const &next_request = self->chunk_requests.front();
+        if (can_downsample_chunk(self, next_request.chunk_i, next_request.level)) {
+            if (downsample_requests.size() == MAX_DOWNSAMPLE_BATCH_SIZE) {
+                break;
             }
+            std::pop_heap(self->chunk_requests.begin(), self->chunk_requests.end(), is_lower_priority);
+            downsample_requests.push_back(self->chunk_requests.back());
+            self->chunk_requests.pop_back();
+            continue;
         }
-        for (auto &[task, user_ptr] : tasks) {
-            thread_pool::wait(task);
-            thread_pool::destroy_task(task);
-            delete (GenChunkArgs *)user_ptr;
+        if (self->generate_tasks.size() >= max_generate_tasks) {
+            break;
         }
-        tasks.clear();
 
-        auto t1 = Clock::now();
-        generate_chunk2s_main_total_ns += (t1 - t0).count();
+        std::pop_heap(self->chunk_requests.begin(), self->chunk_requests.end(), is_lower_priority);
+        auto request = self->chunk_requests.back();
+        self->chunk_requests.pop_back();
+
+        auto *args = new ChunkGenerateTask{.self = self, .chunk = make_chunk(request.chunk_i, request.level)};
+        args->task = thread_pool::create_task(
+            [](void *user_ptr) {
+                auto *args = (ChunkGenerateTask *)user_ptr;
+                args->occupancy = generate_chunk(args->self, args->chunk.get());
+                auto lock = std::lock_guard{args->self->generated_chunks_mutex};
+                args->self->generated_chunks.push_back(args);
+            },
+            args);
+        thread_pool::async_dispatch(args->task);
+        self->generate_tasks.push_back(args);
+    }
+
+    if (!downsample_requests.empty()) {
+        downsample_chunks(self, downsample_requests);
     }
+}
 
+void log_generation_stats(VoxelWorld *self) {
+    auto load_time = std::chrono::duration<float>(Clock::now() - self->start_time).count();
     auto generate_chunk1s_total = std::chrono::duration<float, std::micro>(std::chrono::duration<uint64_t, std::nano>(self->generate_chunk1s_total)).count();
     auto generate_chunk2s_total = std::chrono::duration<float, std::micro>(std::chrono::duration<uint64_t, std::nano>(self->generate_chunk2s_total)).count();
 
-    auto generate_chunk1s_main_total = std::chrono::duration<float, std::micro>(std::chrono::duration<uint64_t, std::nano>(generate_chunk1s_main_total_ns)).count();
-    auto generate_chunk2s_main_total = std::chrono::duration<float, std::micro>(std::chrono::duration<uint64_t, std::nano>(generate_chunk2s_main_total_ns)).count();
-
-    debug_utils::add_log(g_console, fmt::format("1: {} s | {} us/brick ({} total bricks) {} us/brick per thread",
-                                                generate_chunk1s_main_total / 1'000'000,
-                                                generate_chunk1s_main_total / self->generate_chunk1s_total_n,
-                                                self->generate_chunk1s_total_n.load(),
-                                                generate_chunk1s_total / self->generate_chunk1s_total_n)
+    debug_utils::add_log(g_console, fmt::format("loaded {} chunks in {} s", self->chunks.entry_count, load_time).c_str());
+    debug_utils::add_log(g_console, fmt::format("1: {} us/brick per thread ({} total bricks)",
+                                                generate_chunk1s_total / self->generate_chunk1s_total_n,
+                                                self->generate_chunk1s_total_n.load())
                                         .c_str());
-    debug_utils::add_log(g_console, fmt::format("2: {} s | {} us/brick ({} total bricks) {} us/brick per thread",
-                                                generate_chunk2s_main_total / 1'000'000,
-                                                generate_chunk2s_main_total / self->generate_chunk2s_total_n,
-                                                self->generate_chunk2s_total_n.load(),
-                                                generate_chunk2s_total / self->generate_chunk2s_total_n)
+    debug_utils::add_log(g_console, fmt::format("2: {} us/brick per thread ({} total bricks)",
+                                                generate_chunk2s_total / self->generate_chunk2s_total_n,
+                                                self->generate_chunk2s_total_n.load())
                                         .c_str());
 
     ISPCPrintInstrument();
 }
 
+void publish_generated_chunks(VoxelWorld *self) {
+    auto generated_chunks = std::vector<ChunkGenerateTask *>{};
+    {
+        auto lock = std::lock_guard{self->generated_chunks_mutex};
+        generated_chunks.swap(self->generated_chunks);
+    }
+
+    for (auto *args : generated_chunks) {
+        thread_pool::wait(args->task);
+        thread_pool::destroy_task(args->task);
+        std::erase(self->generate_tasks, args);
+
+        auto &chunk = args->chunk;
+        self->requested_chunks.erase(ChunkDirectory::pack_key(chunk->chunk_i.x, chunk->chunk_i.y, chunk->chunk_i.z, chunk->level));
+        --self->requested_counts[chunk->level];
+        // the view may have moved on while it was being generated
+        if (is_chunk_in_view(self, chunk->chunk_i, chunk->level)) {
+            publish_chunk(self, std::move(chunk), args->occupancy);
+        } else {
+            notify_neighbor_chunks(self, chunk->chunk_i, chunk->level, false);
+        }
+        delete args;
+    }
+
+    if (!self->logged_initial_load && self->has_view_centers && self->requested_chunks.empty()) {
+        self->logged_initial_load = true;
+        log_generation_stats(self);
+    }
+}
+
+// Drops the chunks that are out of view, which keeps memory bounded by the view distance. A chunk is
+// kept until the level that replaces it has no more chunks queued, so that no holes open up in between.
+void retire_chunks(VoxelWorld *self) {
+    std::erase_if(self->retire_candidates, [self](glm::ivec4 const &key) {
+        auto chunk_i = glm::ivec3(key);
+        auto level = key.w;
+        auto replacing_level = is_chunk_in_window(self, chunk_i, level) ? level - 1 : level + 1;
+        if (replacing_level < CHUNK_LEVELS && self->requested_counts[replacing_level] != 0) {
+            return false;
+        }
+        // dirty chunks are still referenced by the dirty queue
+        auto *chunk = self->chunks.find(chunk_i.x, chunk_i.y, chunk_i.z, level);
+        if (chunk != nullptr && chunk->dirty_flags.load(std::memory_order_relaxed) != 0) {
+            return false;
+        }
+        self->chunks.erase(chunk_i.x, chunk_i.y, chunk_i.z, level);
+        return true;
+    });
+}
+
+void update_streaming(VoxelWorld *self) {
+    update_view_centers(self);
+    publish_generated_chunks(self);
+    if (!self->retire_candidates.empty()) {
+        retire_chunks(self);
+    }
+    dispatch_chunk_requests(self);
+}
+
 using namespace glm;
 
 struct Ray {
@@ -640,56 +1208,86 @@ auto get_brick_i(ivec3 p) {
     return positive_mod(p, int(BRICK_CHUNK_SIZE));
 }
 
-auto get_voxel_is_solid(VoxelWorld *self, ivec3 p) -> bool {
-    ivec3 chunk_i = get_chunk_i(p);
+// Expands a uniform brick into a mixed one. Bricks of chunks that were never generated get generated here.
+auto get_or_generate_brick(Chunk *chunk, int brick_index, ivec3 brick_i, ivec3 chunk_i) -> BrickSlot {
+    auto slot = chunk->bricks[brick_index];
+    if (!is_mixed_brick(slot)) {
+        auto occupancy = get_brick_occupancy(slot);
+        slot = chunk->allocate_brick();
+        chunk->bricks[brick_index] = slot;
+        auto &bitmask = chunk->brick_bitmasks[slot];
+        if (chunk->generation_stage == NOT_GENERATED) {
+            auto densities = VoxelSimAttribBrick{};
+            generate_bitmask(brick_i.x, brick_i.y, brick_i.z, chunk_i.x, chunk_i.y, chunk_i.z, 0, bitmask.bits, &bitmask.metadata, densities.densities, &generator, RANDOM_VALUES.data());
+        } else if (occupancy == OCCUPANCY_SOLID) {
+            bitmask = make_solid_brick_bitmask();
+        } else {
+            bitmask = AIR_BRICK_BITMASK;
+        }
+    }
+    return slot;
+}
 
-    if (any(lessThan(chunk_i, -ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ))) || any(greaterThanEqual(chunk_i, ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ)))) {
-        return false;
+void generate_brick_attribs(Chunk *chunk, BrickSlot slot, ivec3 brick_i, ivec3 chunk_i) {
+    if (chunk->brick_render_attribs[slot] == INVALID_RENDER_ATTRIBS) {
+        chunk->brick_render_attribs[slot] = s_render_attrib_pool.allocate();
+    }
+    if (chunk->brick_sim_attribs[slot] == INVALID_SIM_ATTRIBS) {
+        chunk->brick_sim_attribs[slot] = s_sim_attrib_pool.allocate();
     }
+    auto density_tile = DensityTile{};
+    generate_density_tile(brick_i.x, brick_i.y, brick_i.z, chunk_i.x, chunk_i.y, chunk_i.z, 0, density_tile.densities, nullptr, false, &generator, RANDOM_VALUES.data());
+    generate_attributes((uint32_t *)chunk->get_render_attribs(slot)->packed_voxels, (float *)chunk->get_sim_attribs(slot)->densities, density_tile.densities, RANDOM_VALUES.data());
+}
+
+auto get_voxel_is_solid(VoxelWorld *self, ivec3 p) -> bool {
+    ivec3 chunk_i = get_chunk_i(p);
 
     ivec3 brick_i = get_brick_i(p);
     ivec3 voxel_i = positive_mod(p, int(VOXEL_BRICK_SIZE));
-    auto chunk_index = get_chunk_index(chunk_i.x, chunk_i.y, chunk_i.z, 0);
     auto brick_index = brick_i.x + brick_i.y * BRICK_CHUNK_SIZE + brick_i.z * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
     auto voxel_index = voxel_i.x + voxel_i.y * VOXEL_BRICK_SIZE + voxel_i.z * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE;
-    auto &chunk = self->chunks[chunk_index];
-    if (!chunk) {
-        return false;
+    auto lookup = self->chunks.lookup(chunk_i.x, chunk_i.y, chunk_i.z, 0);
+    if (lookup.chunk == nullptr) {
+        return lookup.found && lookup.occupancy == OCCUPANCY_SOLID;
     }
-    auto &brick = chunk->bricks[brick_index];
-    if (!brick) {
-        return false;
+    auto slot = lookup.chunk->bricks[brick_index];
+    if (!is_mixed_brick(slot)) {
+        return slot == BRICK_SOLID;
     }
-    auto &brick_bitmask = brick->bitmask;
+    auto &brick_bitmask = lookup.chunk->brick_bitmasks[slot];
     uint voxel_word_index = voxel_index / 32;
     uint voxel_in_word_index = voxel_index % 32;
     return ((brick_bitmask.bits[voxel_word_index] >> voxel_in_word_index) & 1) != 0;
 }
 
-void set_voxel_bit(VoxelWorld *self, ivec3 p, bool value) {
+// Carving next to a solid brick exposes it, so it has to become a mixed brick to get a surface.
+void expand_solid_brick(VoxelWorld *self, ivec3 p) {
     ivec3 chunk_i = get_chunk_i(p);
 
-    if (any(lessThan(chunk_i, -ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ))) || any(greaterThanEqual(chunk_i, ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ)))) {
+    ivec3 brick_i = get_brick_i(p);
+    auto brick_index = brick_i.x + brick_i.y * BRICK_CHUNK_SIZE + brick_i.z * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
+    auto lookup = self->chunks.lookup(chunk_i.x, chunk_i.y, chunk_i.z, 0);
+    auto is_solid = lookup.chunk != nullptr ? lookup.chunk->bricks[brick_index] == BRICK_SOLID : lookup.found && lookup.occupancy == OCCUPANCY_SOLID;
+    if (!is_solid) {
         return;
     }
+    auto *chunk = self->chunks.find_or_insert(chunk_i.x, chunk_i.y, chunk_i.z, 0);
+    get_or_generate_brick(chunk, brick_index, brick_i, chunk_i);
+    self->dirty_chunks.mark_dirty(chunk, CHUNK_DIRTY_BRICKS);
+}
+
+void set_voxel_bit(VoxelWorld *self, ivec3 p, bool value) {
+    ivec3 chunk_i = get_chunk_i(p);
 
     ivec3 brick_i = get_brick_i(p);
     ivec3 voxel_i = positive_mod(p, int(VOXEL_BRICK_SIZE));
-    auto chunk_index = get_chunk_index(chunk_i.x, chunk_i.y, chunk_i.z, 0);
     auto brick_index = brick_i.x + brick_i.y * BRICK_CHUNK_SIZE + brick_i.z * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
     auto voxel_index = voxel_i.x + voxel_i.y * VOXEL_BRICK_SIZE + voxel_i.z * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE;
 
-    auto &chunk = self->chunks[chunk_index];
-    if (!chunk) {
-        chunk = std::make_unique<Chunk>();
-        chunk->pos = chunk_i;
-    }
-    auto &brick = chunk->bricks[brick_index];
-    if (!brick) {
-        brick = std::make_unique<Brick>();
-        generate_bitmask(brick_i.x, brick_i.y, brick_i.z, chunk_i.x, chunk_i.y, chunk_i.z, 0, brick->bitmask.bits, &brick->bitmask.metadata, &noise_settings, RANDOM_VALUES.data());
-    }
-    auto &brick_bitmask = brick->bitmask;
+    auto *chunk = self->chunks.find_or_insert(chunk_i.x, chunk_i.y, chunk_i.z, 0);
+    auto slot = get_or_generate_brick(chunk, brick_index, brick_i, chunk_i);
+    auto &brick_bitmask = chunk->brick_bitmasks[slot];
     uint voxel_word_index = voxel_index / 32;
     uint voxel_in_word_index = voxel_index % 32;
 
@@ -698,18 +1296,14 @@ void set_voxel_bit(VoxelWorld *self, ivec3 p, bool value) {
     auto &brick_metadata = get_brick_metadata(chunk, brick_index);
 
     if (prev_value != value) {
-        chunk->bricks_changed = true;
+        self->dirty_chunks.mark_dirty(chunk, CHUNK_DIRTY_BRICKS);
 
         auto notify_neighbor_chunk = [self](glm::ivec3 n_chunk_i) {
-            if (any(lessThan(n_chunk_i, -ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ))) || any(greaterThanEqual(n_chunk_i, ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ)))) {
-                return;
-            }
-            auto n_chunk_index = get_chunk_index(n_chunk_i.x, n_chunk_i.y, n_chunk_i.z, 0);
-            auto &n_chunk = self->chunks[n_chunk_index];
-            if (!n_chunk) {
+            auto *n_chunk = self->chunks.find(n_chunk_i.x, n_chunk_i.y, n_chunk_i.z, 0);
+            if (n_chunk == nullptr) {
                 return;
             }
-            n_chunk->bricks_changed = true;
+            self->dirty_chunks.mark_dirty(n_chunk, CHUNK_DIRTY_BRICKS);
         };
 
         if (voxel_i.x == 0 && brick_i.x == 0) {
@@ -732,12 +1326,8 @@ void set_voxel_bit(VoxelWorld *self, ivec3 p, bool value) {
     if (value) {
         brick_bitmask.bits[voxel_word_index] |= 1 << voxel_in_word_index;
         brick_metadata.has_voxel = true;
-        auto &render_attrib_brick = brick->render_attribs;
-        auto &sim_attrib_brick = brick->sim_attribs;
-        if (!render_attrib_brick) {
-            render_attrib_brick = std::make_unique<VoxelRenderAttribBrick>();
-            sim_attrib_brick = std::make_unique<VoxelSimAttribBrick>();
-            generate_attributes(brick_i.x, brick_i.y, brick_i.z, chunk_i.x, chunk_i.y, chunk_i.z, 0, (uint32_t *)render_attrib_brick->packed_voxels, (float *)sim_attrib_brick->densities, &noise_settings, RANDOM_VALUES.data());
+        if (chunk->brick_render_attribs[slot] == INVALID_RENDER_ATTRIBS) {
+            generate_brick_attribs(chunk, slot, brick_i, chunk_i);
         }
     } else {
         brick_bitmask.bits[voxel_word_index] &= ~(1 << voxel_in_word_index);
@@ -747,6 +1337,24 @@ void set_voxel_bit(VoxelWorld *self, ivec3 p, bool value) {
         brick_metadata.has_air_ny = brick_metadata.has_air_ny || voxel_i.y == 0;
         brick_metadata.has_air_pz = brick_metadata.has_air_pz || voxel_i.z == VOXEL_BRICK_SIZE - 1;
         brick_metadata.has_air_nz = brick_metadata.has_air_nz || voxel_i.z == 0;
+
+        if (prev_value) {
+            if (voxel_i.x == 0) {
+                expand_solid_brick(self, p - ivec3(1, 0, 0));
+            } else if (voxel_i.x == VOXEL_BRICK_SIZE - 1) {
+                expand_solid_brick(self, p + ivec3(1, 0, 0));
+            }
+            if (voxel_i.y == 0) {
+                expand_solid_brick(self, p - ivec3(0, 1, 0));
+            } else if (voxel_i.y == VOXEL_BRICK_SIZE - 1) {
+                expand_solid_brick(self, p + ivec3(0, 1, 0));
+            }
+            if (voxel_i.z == 0) {
+                expand_solid_brick(self, p - ivec3(0, 0, 1));
+            } else if (voxel_i.z == VOXEL_BRICK_SIZE - 1) {
+                expand_solid_brick(self, p + ivec3(0, 0, 1));
+            }
+        }
     }
 }
 
@@ -755,38 +1363,22 @@ void set_voxel_bit(VoxelWorld *self, ivec3 p, bool value) {
 void set_voxel_attrib(VoxelWorld *self, ivec3 p, Voxel value) {
     ivec3 chunk_i = get_chunk_i(p);
 
-    if (any(lessThan(chunk_i, -ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ))) || any(greaterThanEqual(chunk_i, ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ)))) {
-        return;
-    }
-
     ivec3 brick_i = get_brick_i(p);
     ivec3 voxel_i = positive_mod(p, int(VOXEL_BRICK_SIZE));
-    auto chunk_index = get_chunk_index(chunk_i.x, chunk_i.y, chunk_i.z, 0);
     auto brick_index = brick_i.x + brick_i.y * BRICK_CHUNK_SIZE + brick_i.z * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
     auto voxel_index = voxel_i.x + voxel_i.y * VOXEL_BRICK_SIZE + voxel_i.z * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE;
-    auto &chunk = self->chunks[chunk_index];
-    if (!chunk) {
-        chunk = std::make_unique<Chunk>();
-        chunk->pos = chunk_i;
-    }
-    auto &brick = chunk->bricks[brick_index];
-    if (!brick) {
-        brick = std::make_unique<Brick>();
-        generate_bitmask(brick_i.x, brick_i.y, brick_i.z, chunk_i.x, chunk_i.y, chunk_i.z, 0, brick->bitmask.bits, &brick->bitmask.metadata, &noise_settings, RANDOM_VALUES.data());
-    }
-    auto &render_attrib_brick = brick->render_attribs;
-    if (!render_attrib_brick) {
-        auto &sim_attrib_brick = brick->sim_attribs;
-        render_attrib_brick = std::make_unique<VoxelRenderAttribBrick>();
-        sim_attrib_brick = std::make_unique<VoxelSimAttribBrick>();
-        generate_attributes(brick_i.x, brick_i.y, brick_i.z, chunk_i.x, chunk_i.y, chunk_i.z, 0, (uint32_t *)render_attrib_brick->packed_voxels, (float *)sim_attrib_brick->densities, &noise_settings, RANDOM_VALUES.data());
+    auto *chunk = self->chunks.find_or_insert(chunk_i.x, chunk_i.y, chunk_i.z, 0);
+    auto slot = get_or_generate_brick(chunk, brick_index, brick_i, chunk_i);
+    if (chunk->brick_render_attribs[slot] == INVALID_RENDER_ATTRIBS) {
+        generate_brick_attribs(chunk, slot, brick_i, chunk_i);
     }
+    auto *render_attrib_brick = chunk->get_render_attribs(slot);
 
     PackedVoxel prev_value = render_attrib_brick->packed_voxels[voxel_index];
     PackedVoxel new_value = pack_voxel(value);
 
     if (prev_value.data != new_value.data) {
-        chunk->bricks_changed = true;
+        self->dirty_chunks.mark_dirty(chunk, CHUNK_DIRTY_RENDER);
     }
 
     render_attrib_brick->packed_voxels[voxel_index] = new_value;
@@ -795,161 +1387,274 @@ void set_voxel_attrib(VoxelWorld *self, ivec3 p, Voxel value) {
 void set_voxel_sim_attrib(VoxelWorld *self, ivec3 p, float density) {
     ivec3 chunk_i = get_chunk_i(p);
 
-    if (any(lessThan(chunk_i, -ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ))) || any(greaterThanEqual(chunk_i, ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ)))) {
-        return;
-    }
-
     ivec3 brick_i = get_brick_i(p);
     ivec3 voxel_i = positive_mod(p, int(VOXEL_BRICK_SIZE));
-    auto chunk_index = get_chunk_index(chunk_i.x, chunk_i.y, chunk_i.z, 0);
     auto brick_index = brick_i.x + brick_i.y * BRICK_CHUNK_SIZE + brick_i.z * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
     auto voxel_index = voxel_i.x + voxel_i.y * VOXEL_BRICK_SIZE + voxel_i.z * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE;
-    auto &chunk = self->chunks[chunk_index];
-    if (!chunk) {
-        chunk = std::make_unique<Chunk>();
-        chunk->pos = chunk_i;
-    }
-    auto &brick = chunk->bricks[brick_index];
-    if (!brick) {
-        brick = std::make_unique<Brick>();
-        generate_bitmask(brick_i.x, brick_i.y, brick_i.z, chunk_i.x, chunk_i.y, chunk_i.z, 0, brick->bitmask.bits, &brick->bitmask.metadata, &noise_settings, RANDOM_VALUES.data());
-    }
-    auto &sim_attrib_brick = brick->sim_attribs;
-    if (!sim_attrib_brick) {
-        auto &render_attrib_brick = brick->render_attribs;
-        render_attrib_brick = std::make_unique<VoxelRenderAttribBrick>();
-        sim_attrib_brick = std::make_unique<VoxelSimAttribBrick>();
-        generate_attributes(brick_i.x, brick_i.y, brick_i.z, chunk_i.x, chunk_i.y, chunk_i.z, 0, (uint32_t *)render_attrib_brick->packed_voxels, (float *)sim_attrib_brick->densities, &noise_settings, RANDOM_VALUES.data());
-    }
-
-    auto prev_value = sim_attrib_brick->densities[voxel_index];
-    auto new_value = density;
-
-    if (prev_value != new_value) {
-        chunk->bricks_changed = true;
+    auto *chunk = self->chunks.find_or_insert(chunk_i.x, chunk_i.y, chunk_i.z, 0);
+    auto slot = get_or_generate_brick(chunk, brick_index, brick_i, chunk_i);
+    if (chunk->brick_sim_attribs[slot] == INVALID_SIM_ATTRIBS) {
+        generate_brick_attribs(chunk, slot, brick_i, chunk_i);
     }
+    auto *sim_attrib_brick = chunk->get_sim_attribs(slot);
 
-    sim_attrib_brick->densities[voxel_index] = new_value;
+    // densities aren't rendered, so this doesn't dirty the chunk
+    sim_attrib_brick->densities[voxel_index] = density;
 }
 
 auto get_voxel_sim_attrib(VoxelWorld *self, ivec3 p, bool generate) -> float {
     ivec3 chunk_i = get_chunk_i(p);
 
-    if (any(lessThan(chunk_i, -ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ))) || any(greaterThanEqual(chunk_i, ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ)))) {
-        return 0;
-    }
-
     ivec3 brick_i = get_brick_i(p);
     ivec3 voxel_i = positive_mod(p, int(VOXEL_BRICK_SIZE));
-    auto chunk_index = get_chunk_index(chunk_i.x, chunk_i.y, chunk_i.z, 0);
     auto brick_index = brick_i.x + brick_i.y * BRICK_CHUNK_SIZE + brick_i.z * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
     auto voxel_index = voxel_i.x + voxel_i.y * VOXEL_BRICK_SIZE + voxel_i.z * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE;
-    auto &chunk = self->chunks[chunk_index];
-    if (!chunk) {
-        if (generate) {
-            chunk = std::make_unique<Chunk>();
-            chunk->pos = chunk_i;
-        } else {
-            return 0;
-        }
-    }
-    auto &brick = chunk->bricks[brick_index];
-    if (!brick) {
-        brick = std::make_unique<Brick>();
-        generate_bitmask(brick_i.x, brick_i.y, brick_i.z, chunk_i.x, chunk_i.y, chunk_i.z, 0, brick->bitmask.bits, &brick->bitmask.metadata, &noise_settings, RANDOM_VALUES.data());
+    auto *chunk = generate ? self->chunks.find_or_insert(chunk_i.x, chunk_i.y, chunk_i.z, 0) : self->chunks.find(chunk_i.x, chunk_i.y, chunk_i.z, 0);
+    if (chunk == nullptr) {
+        return 0;
     }
-    auto &sim_attrib_brick = brick->sim_attribs;
+    auto slot = get_or_generate_brick(chunk, brick_index, brick_i, chunk_i);
 
-    if (!sim_attrib_brick) {
+    if (chunk->brick_sim_attribs[slot] == INVALID_SIM_ATTRIBS) {
         if (generate) {
-            auto &render_attrib_brick = brick->render_attribs;
-            render_attrib_brick = std::make_unique<VoxelRenderAttribBrick>();
-            sim_attrib_brick = std::make_unique<VoxelSimAttribBrick>();
-            generate_attributes(brick_i.x, brick_i.y, brick_i.z, chunk_i.x, chunk_i.y, chunk_i.z, 0, (uint32_t *)render_attrib_brick->packed_voxels, (float *)sim_attrib_brick->densities, &noise_settings, RANDOM_VALUES.data());
+            generate_brick_attribs(chunk, slot, brick_i, chunk_i);
         } else {
             return 0;
         }
     }
 
-    return sim_attrib_brick->densities[voxel_index];
+    return chunk->get_sim_attribs(slot)->densities[voxel_index];
 }
 
 auto get_voxel_attrib(VoxelWorld *self, ivec3 p) -> Voxel {
     ivec3 chunk_i = get_chunk_i(p);
 
-    if (any(lessThan(chunk_i, -ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ))) || any(greaterThanEqual(chunk_i, ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ)))) {
-        return {};
-    }
-
     ivec3 brick_i = get_brick_i(p);
     ivec3 voxel_i = positive_mod(p, int(VOXEL_BRICK_SIZE));
-    auto chunk_index = get_chunk_index(chunk_i.x, chunk_i.y, chunk_i.z, 0);
     auto brick_index = brick_i.x + brick_i.y * BRICK_CHUNK_SIZE + brick_i.z * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
     auto voxel_index = voxel_i.x + voxel_i.y * VOXEL_BRICK_SIZE + voxel_i.z * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE;
-    auto &chunk = self->chunks[chunk_index];
-    if (!chunk) {
+    auto *chunk = self->chunks.find(chunk_i.x, chunk_i.y, chunk_i.z, 0);
+    if (chunk == nullptr) {
         return {};
     }
-    auto &brick = chunk->bricks[brick_index];
-    if (!brick) {
+    if (!is_mixed_brick(chunk->bricks[brick_index])) {
         return {};
     }
-    auto &brick_attribs = brick->render_attribs;
-    if (!brick_attribs) {
+    auto slot = chunk->bricks[brick_index];
+    if (chunk->brick_render_attribs[slot] == INVALID_RENDER_ATTRIBS) {
         return {};
     }
 
-    return unpack_voxel(brick_attribs->packed_voxels[voxel_index]);
+    return unpack_voxel(chunk->get_render_attribs(slot)->packed_voxels[voxel_index]);
 }
 
-auto dda_voxels(VoxelWorld *self, Ray ray, int max_iter, float max_dist) -> std::tuple<ivec3, ivec3, float> {
-    using Line = std::array<vec3, 3>;
-    using Point = std::array<vec3, 3>;
-    using Box = std::array<vec3, 3>;
+auto pack_downsampled_voxel(vec3 col, vec3 nrm_sum) -> PackedVoxel {
+    // opposing normals can cancel out
+    auto nrm = dot(nrm_sum, nrm_sum) > 0.0f ? normalize(nrm_sum) : vec3(0.0f, 0.0f, 1.0f);
+    return pack_voxel(Voxel{.col = {col.x, col.y, col.z}, .nrm = {nrm.x, nrm.y, nrm.z}});
+}
+
+// Averages the colors and normals of the finer voxels under each solid voxel of a downsampled brick. Solid
+// voxels that only cover finer voxels without attributes, which are mostly interior ones, get the brick's
+// average. Returns false if none of the finer voxels have attributes.
+auto downsample_brick_attribs(VoxelRenderAttribBrick *dst, uint32_t const dst_bits[], std::array<VoxelBrickBitmask const *, 8> const &src_bitmasks, std::array<VoxelRenderAttribBrick const *, 8> const &src_attribs) -> bool {
+    constexpr int HALF_SIZE = VOXEL_BRICK_SIZE / 2;
+    auto is_bit_set = [](uint32_t const bits[], int index) { return ((bits[index / 32] >> (index % 32)) & 1) != 0; };
+
+    auto brick_col = vec3(0.0f);
+    auto brick_nrm = vec3(0.0f);
+    auto brick_count = 0;
+    auto missing_bits = std::array<uint32_t, VOXELS_PER_BRICK / 32>{};
+
+    for (int zi = 0; zi < VOXEL_BRICK_SIZE; ++zi) {
+        for (int yi = 0; yi < VOXEL_BRICK_SIZE; ++yi) {
+            for (int xi = 0; xi < VOXEL_BRICK_SIZE; ++xi) {
+                auto voxel_index = xi + yi * VOXEL_BRICK_SIZE + zi * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE;
+                dst->packed_voxels[voxel_index] = {};
+                if (!is_bit_set(dst_bits, voxel_index)) {
+                    continue;
+                }
+                auto octant_i = (xi / HALF_SIZE) + (yi / HALF_SIZE) * 2 + (zi / HALF_SIZE) * 4;
+                auto const *src = src_attribs[octant_i];
+                auto col = vec3(0.0f);
+                auto nrm = vec3(0.0f);
+                auto count = 0;
+                for (int sub_i = 0; src != nullptr && sub_i < 8; ++sub_i) {
+                    auto src_x = (xi % HALF_SIZE) * 2 + (sub_i & 1);
+                    auto src_y = (yi % HALF_SIZE) * 2 + ((sub_i >> 1) & 1);
+                    auto src_z = (zi % HALF_SIZE) * 2 + (sub_i >> 2);
+                    auto src_index = src_x + src_y * VOXEL_BRICK_SIZE + src_z * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE;
+                    if (!is_bit_set(src_bitmasks[octant_i]->bits, src_index)) {
+                        continue;
+                    }
+                    auto voxel = unpack_voxel(src->packed_voxels[src_index]);
+                    col += vec3(voxel.col.x, voxel.col.y, voxel.col.z);
+                    nrm += vec3(voxel.nrm.x, voxel.nrm.y, voxel.nrm.z);
+                    ++count;
+                }
+                if (count == 0) {
+                    missing_bits[voxel_index / 32] |= 1u << (voxel_index % 32);
+                    continue;
+                }
+                brick_col += col;
+                brick_nrm += nrm;
+                brick_count += count;
+                dst->packed_voxels[voxel_index] = pack_downsampled_voxel(col / float(count), nrm);
+            }
+        }
+    }
 
-    ray.origin += glm::vec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ) * float(VOXEL_CHUNK_SIZE) * VOXEL_SIZE;
+    if (brick_count == 0) {
+        return false;
+    }
+    auto brick_voxel = pack_downsampled_voxel(brick_col / float(brick_count), brick_nrm);
+    for (int voxel_index = 0; voxel_index < VOXELS_PER_BRICK; ++voxel_index) {
+        if (is_bit_set(missing_bits.data(), voxel_index)) {
+            dst->packed_voxels[voxel_index] = brick_voxel;
+        }
+    }
+    return true;
+}
+
+// Builds a chunk by 2x2x2 reduction of the 8 chunks of the next finer level, see can_downsample_chunk. Like
+// generate_bricks, it fills in the render attributes of bricks that are likely to end up on the surface, and
+// generate_chunk2 evaluates the generator for the rest.
+auto downsample_chunk(VoxelWorld *self, Chunk *chunk) -> Occupancy {
+    constexpr int32_t HALF_CHUNK_SIZE = BRICK_CHUNK_SIZE / 2;
+    auto min_solid_count = self->lod_downsampling == voxel_world::LodDownsampling::ANY_SOLID ? 1 : 4;
+
+    auto children = std::array<ChunkLookup, 8>{};
+    auto is_uniform = true;
+    for (uint32_t octant_i = 0; octant_i < 8; ++octant_i) {
+        auto child_chunk_i = get_child_chunk_i(chunk->chunk_i, octant_i);
+        children[octant_i] = self->chunks.lookup(child_chunk_i.x, child_chunk_i.y, child_chunk_i.z, chunk->level - 1);
+        is_uniform = is_uniform && children[octant_i].chunk == nullptr && children[octant_i].occupancy == children[0].occupancy;
+    }
+
+    chunk->generation_stage = GENERATED_BITMASK;
+    if (is_uniform) {
+        chunk->free_bricks(children[0].occupancy == OCCUPANCY_SOLID ? BRICK_SOLID : BRICK_AIR);
+        return children[0].occupancy;
+    }
+    chunk->free_bricks();
+
+    auto has_air = false;
+    auto has_solid = false;
+    for (int32_t brick_zi = 0; brick_zi < BRICK_CHUNK_SIZE; ++brick_zi) {
+        for (int32_t brick_yi = 0; brick_yi < BRICK_CHUNK_SIZE; ++brick_yi) {
+            for (int32_t brick_xi = 0; brick_xi < BRICK_CHUNK_SIZE; ++brick_xi) {
+                auto brick_index = brick_xi + brick_yi * BRICK_CHUNK_SIZE + brick_zi * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
+                auto const &child = children[(brick_xi / HALF_CHUNK_SIZE) + (brick_yi / HALF_CHUNK_SIZE) * 2 + (brick_zi / HALF_CHUNK_SIZE) * 4];
+                auto child_brick_i = glm::ivec3(brick_xi, brick_yi, brick_zi) * 2 % BRICK_CHUNK_SIZE;
+
+                auto src_bitmasks = std::array<VoxelBrickBitmask const *, 8>{};
+                auto src_attribs = std::array<VoxelRenderAttribBrick const *, 8>{};
+                auto air_count = 0;
+                auto solid_count = 0;
+                for (uint32_t octant_i = 0; octant_i < 8; ++octant_i) {
+                    auto src_brick_i = child_brick_i + glm::ivec3(octant_i & 1, (octant_i >> 1) & 1, octant_i >> 2);
+                    auto src_brick_index = src_brick_i.x + src_brick_i.y * BRICK_CHUNK_SIZE + src_brick_i.z * BRICK_CHUNK_SIZE * BRICK_CHUNK_SIZE;
+                    auto src_slot = child.chunk != nullptr ? child.chunk->bricks[src_brick_index] : child.occupancy == OCCUPANCY_SOLID ? BRICK_SOLID : BRICK_AIR;
+                    switch (get_brick_occupancy(src_slot)) {
+                    case OCCUPANCY_AIR:
+                        src_bitmasks[octant_i] = &AIR_BRICK_BITMASK;
+                        ++air_count;
+                        break;
+                    case OCCUPANCY_SOLID:
+                        src_bitmasks[octant_i] = &SOLID_BRICK_BITMASK;
+                        ++solid_count;
+                        break;
+                    default:
+                        src_bitmasks[octant_i] = &child.chunk->brick_bitmasks[src_slot];
+                        if (child.chunk->brick_render_attribs[src_slot] != INVALID_RENDER_ATTRIBS) {
+                            src_attribs[octant_i] = child.chunk->get_render_attribs(src_slot);
+                        }
+                        break;
+                    }
+                }
 
-    float tHit = -1;
-    GlmAabb aabb = {glm::vec3(0), glm::vec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ) * float(VOXEL_CHUNK_SIZE) * 2.0f};
-    tHit = hitAabb(aabb, ray);
-    const float BIAS = uintBitsToFloat(0x3f800040); // uintBitsToFloat(0x3f800040) == 1.00000762939453125
-    ray.origin += ray.direction * tHit * BIAS;
+                auto bits = std::array<uint32_t, VOXELS_PER_BRICK / 32>{};
+                if (air_count != 8 && solid_count != 8) {
+                    for (uint32_t octant_i = 0; octant_i < 8; ++octant_i) {
+                        downsample_brick_octant(bits.data(), int(octant_i), src_bitmasks[octant_i]->bits, min_solid_count);
+                    }
+                }
+                auto is_air = std::all_of(bits.begin(), bits.end(), [](uint32_t word) { return word == 0u; });
+                auto is_solid = solid_count == 8 || std::all_of(bits.begin(), bits.end(), [](uint32_t word) { return word == ~0u; });
+                if (is_solid || is_air) {
+                    chunk->bricks[brick_index] = is_solid ? BRICK_SOLID : BRICK_AIR;
+                    has_solid = has_solid || is_solid;
+                    has_air = has_air || !is_solid;
+                    continue;
+                }
+                has_air = true;
+                has_solid = true;
+
+                auto slot = chunk->allocate_brick();
+                chunk->bricks[brick_index] = slot;
+                auto &bitmask = chunk->brick_bitmasks[slot];
+                std::copy(bits.begin(), bits.end(), bitmask.bits);
+                auto &metadata = get_brick_metadata(chunk, brick_index);
+                metadata.has_voxel = true;
+                metadata.has_air_nx = extract_brick_face(bitmask.bits, 0, 0) != ~uint64_t{0};
+                metadata.has_air_ny = extract_brick_face(bitmask.bits, 1, 0) != ~uint64_t{0};
+                metadata.has_air_nz = extract_brick_face(bitmask.bits, 2, 0) != ~uint64_t{0};
+                metadata.has_air_px = extract_brick_face(bitmask.bits, 0, VOXEL_BRICK_SIZE - 1) != ~uint64_t{0};
+                metadata.has_air_py = extract_brick_face(bitmask.bits, 1, VOXEL_BRICK_SIZE - 1) != ~uint64_t{0};
+                metadata.has_air_pz = extract_brick_face(bitmask.bits, 2, VOXEL_BRICK_SIZE - 1) != ~uint64_t{0};
+
+                if (metadata.has_air_nx || metadata.has_air_ny || metadata.has_air_nz || metadata.has_air_px || metadata.has_air_py || metadata.has_air_pz) {
+                    chunk->brick_render_attribs[slot] = s_render_attrib_pool.allocate();
+                    if (!downsample_brick_attribs(chunk->get_render_attribs(slot), bitmask.bits, src_bitmasks, src_attribs)) {
+                        s_render_attrib_pool.free(chunk->brick_render_attribs[slot]);
+                        chunk->brick_render_attribs[slot] = INVALID_RENDER_ATTRIBS;
+                    }
+                }
+            }
+        }
+    }
 
-    if (tHit < 0) {
-        return {ivec3{0, 0, 0}, ivec3{0, 0, 0}, -1.0f};
+    if (!has_solid || !has_air) {
+        auto occupancy = has_solid ? OCCUPANCY_SOLID : OCCUPANCY_AIR;
+        chunk->free_bricks(occupancy == OCCUPANCY_SOLID ? BRICK_SOLID : BRICK_AIR);
+        return occupancy;
     }
+    return OCCUPANCY_MIXED;
+}
+
+auto dda_voxels(VoxelWorld *self, Ray ray, int max_iter, float max_dist) -> std::tuple<ivec3, ivec3, float> {
+    using Line = std::array<vec3, 3>;
+    using Point = std::array<vec3, 3>;
+    using Box = std::array<vec3, 3>;
 
-    ivec3 bmin = ivec3(floor(aabb.minimum));
-    ivec3 mapPos = clamp(ivec3(floor(ray.origin * VOXEL_SCL)) - bmin, ivec3(aabb.minimum), ivec3(aabb.maximum));
+    ivec3 mapPos = ivec3(floor(ray.origin * VOXEL_SCL));
     vec3 deltaDist = abs(vec3(length(ray.direction)) / ray.direction);
-    vec3 sideDist = (sign(ray.direction) * (vec3(mapPos + bmin) - ray.origin * VOXEL_SCL) + (sign(ray.direction) * 0.5f) + 0.5f) * deltaDist;
+    vec3 sideDist = (sign(ray.direction) * (vec3(mapPos) - ray.origin * VOXEL_SCL) + (sign(ray.direction) * 0.5f) + 0.5f) * deltaDist;
     ivec3 rayStep = ivec3(sign(ray.direction));
     bvec3 mask = lessThanEqual(sideDist, min(vec3(sideDist.y, sideDist.z, sideDist.x), vec3(sideDist.z, sideDist.x, sideDist.y)));
 
     // vec3 prev_pos = (vec3(mapPos) + 0.5f) * VOXEL_SIZE;
-    const int max_steps = min(max_iter, int(aabb.maximum.x + aabb.maximum.y + aabb.maximum.z));
 
-    for (int i = 0; i < max_steps; i++) {
-        if (get_voxel_is_solid(self, mapPos - ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ) * VOXEL_CHUNK_SIZE) == true) {
-            aabb.minimum += vec3(mapPos) * VOXEL_SIZE;
+    // The world is unbounded, so the march is only limited by max_iter and max_dist
+    for (int i = 0; i < max_iter; i++) {
+        if (get_voxel_is_solid(self, mapPos) == true) {
+            GlmAabb aabb;
+            aabb.minimum = vec3(mapPos) * VOXEL_SIZE;
             aabb.maximum = aabb.minimum + VOXEL_SIZE;
-            tHit += hitAabb(aabb, ray);
+            float tHit = hitAabb(aabb, ray);
 
             // int x_face = (mask.x * ((rayStep.x + 1) / 2 + 0));
             // int y_face = (mask.y * ((rayStep.y + 1) / 2 + 2));
             // int z_face = (mask.z * ((rayStep.z + 1) / 2 + 4));
             // x_face + y_face + z_face
 
-            return {mapPos - ivec3(CHUNK_NX, CHUNK_NY, CHUNK_NZ) * VOXEL_CHUNK_SIZE, -rayStep * ivec3(mask), tHit};
+            return {mapPos, -rayStep * ivec3(mask), tHit};
         }
         mask = lessThanEqual(sideDist, min(vec3(sideDist.y, sideDist.z, sideDist.x), vec3(sideDist.z, sideDist.x, sideDist.y)));
         sideDist += vec3(mask) * deltaDist;
         mapPos += ivec3(vec3(mask)) * rayStep;
-        bool outside_l = any(lessThan(mapPos, ivec3(aabb.minimum)));
-        bool outside_g = any(greaterThanEqual(mapPos, ivec3(aabb.maximum)));
         float dist = dot(sideDist, vec3(mask));
-        bool past_max_dist = dist > max_dist;
-        if ((int(outside_l) | int(outside_g) | int(past_max_dist)) != 0) {
+        if (dist > max_dist) {
             break;
         }
 
@@ -964,14 +1669,90 @@ auto dda_voxels(VoxelWorld *self, Ray ray, int max_iter, float max_dist) -> std:
     return {ivec3{0, 0, 0}, {0, 0, 0}, -1.0f};
 }
 
+// Re-runs generate_chunk2 and gathers the render data of dirty chunks on the thread pool, in
+// batches. Once a batch ends past the remesh budget, the remaining chunks are deferred to the next frame.
+void remesh_dirty_chunks(VoxelWorld *self) {
+    constexpr size_t REMESH_BATCH_SIZE = 32;
+
+    struct RemeshChunkArgs {
+        VoxelWorld *self;
+        Chunk *chunk;
+        uint32_t flags;
+    };
+
+    auto &dirty_chunks = self->dirty_chunks_scratch;
+    dirty_chunks.clear();
+    dirty_chunks.swap(self->deferred_dirty_chunks);
+    self->dirty_chunks.drain(dirty_chunks);
+
+    auto t0 = Clock::now();
+    auto batch_args = std::array<RemeshChunkArgs, REMESH_BATCH_SIZE>{};
+
+    size_t chunk_i = 0;
+    while (chunk_i < dirty_chunks.size()) {
+        if (chunk_i != 0 && self->remesh_budget > Clock::duration::zero() && Clock::now() - t0 > self->remesh_budget) {
+            break;
+        }
+
+        auto batch_size = std::min(REMESH_BATCH_SIZE, dirty_chunks.size() - chunk_i);
+        for (size_t i = 0; i < batch_size; ++i) {
+            auto *chunk = dirty_chunks[chunk_i + i];
+            // the renderer's chunk list isn't thread safe, so render chunks are created up front
+            if (chunk->render_chunk == nullptr) {
+                chunk->render_chunk = renderer::create_chunk(g_renderer, (float const *)&chunk->pos);
+            }
+            batch_args[i] = {self, chunk, chunk->dirty_flags.exchange(0, std::memory_order_acq_rel)};
+        }
+        thread_pool::parallel_for(
+            0, uint32_t(batch_size), 1,
+            [](void *user_ptr, uint32_t index) {
+                auto const &args = ((RemeshChunkArgs *)user_ptr)[index];
+                auto *chunk = args.chunk;
+                if ((args.flags & CHUNK_DIRTY_BRICKS) != 0) {
+                    generate_chunk2(args.self, chunk->chunk_i.x, chunk->chunk_i.y, chunk->chunk_i.z, chunk->level, false);
+                }
+                update(chunk->render_chunk, int(chunk->surface_brick_indices.size()), chunk->surface_bitmasks.data(), chunk->surface_render_attribs.data(), (int const *)chunk->surface_pos_scls.data());
+            },
+            batch_args.data(), thread_pool::TaskPriority::HIGH);
+        chunk_i += batch_size;
+    }
+
+    self->deferred_dirty_chunks.assign(dirty_chunks.begin() + ptrdiff_t(chunk_i), dirty_chunks.end());
+}
+
+void voxel_world::set_view_position(VoxelWorld *self, float const *pos) {
+    self->view_pos = glm::vec3(pos[0], pos[1], pos[2]);
+}
+
+auto voxel_world::is_view_loaded(VoxelWorld *self) -> bool {
+    return self->requested_chunks.empty() && self->generate_tasks.empty() && self->deferred_dirty_chunks.empty() && self->dirty_chunks.head.load(std::memory_order_relaxed) == nullptr;
+}
+
+void voxel_world::set_remesh_budget(VoxelWorld *self, float milliseconds) {
+    self->remesh_budget = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float, std::milli>(milliseconds));
+}
+
+void voxel_world::set_lod_downsampling(VoxelWorld *self, LodDownsampling mode) {
+    self->lod_downsampling = mode;
+}
+
+void voxel_world::set_downsample_budget(VoxelWorld *self, float milliseconds) {
+    self->downsample_budget = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float, std::milli>(milliseconds));
+}
+
 auto voxel_world::create() -> VoxelWorld * {
     auto *self = new VoxelWorld{};
     self->start_time = Clock::now();
     self->prev_time = self->start_time;
-    generate_all_chunks(self);
     return self;
 }
 void voxel_world::destroy(VoxelWorld *self) {
+    for (auto *args : self->generate_tasks) {
+        thread_pool::cancel(args->task);
+        thread_pool::wait(args->task);
+        thread_pool::destroy_task(args->task);
+        delete args;
+    }
     delete self;
 }
 
@@ -985,6 +1766,7 @@ void voxel_world::update(VoxelWorld *self) {
         self->prev_time = now;
         noise_settings.scale = (sin(time) * 0.5f + 0.5f) * 0.1f + 0.25f;
         noise_settings.amplitude = 100.0f;
+        generator = make_terrain_generator(noise_settings);
 
         for (int i = 0; i < 8; ++i) {
             int xi = (i >> 0) & 1;
@@ -1002,6 +1784,7 @@ void voxel_world::update(VoxelWorld *self) {
 
         noise_settings.scale = 0.05f;
         noise_settings.amplitude = 20.0f;
+        generator = make_terrain_generator(noise_settings);
 
         for (int i = 0; i < 4; ++i) {
             int xi = (i >> 0) & 1;
@@ -1012,31 +1795,22 @@ void voxel_world::update(VoxelWorld *self) {
         }
     }
 
-    for (uint32_t chunk_index = 0; chunk_index < MAX_CHUNK_COUNT; ++chunk_index) {
-        auto &chunk = self->chunks[chunk_index];
-        if (!chunk) {
-            continue;
-        }
-
-        auto brick_count = chunk->surface_brick_indices.size();
+    update_streaming(self);
+    remesh_dirty_chunks(self);
 
-        if (chunk->bricks_changed) {
-            int xi = int(chunk_index % (CHUNK_NX * 2)) - CHUNK_NX;
-            int yi = int((chunk_index / (CHUNK_NX * 2)) % (CHUNK_NY * 2)) - CHUNK_NY;
-            int zi = int((chunk_index / (CHUNK_NX * 2) / (CHUNK_NY * 2)) % (CHUNK_NZ * 2)) - CHUNK_NZ;
-            int li = (chunk_index / (CHUNK_NX * 2) / (CHUNK_NY * 2) / (CHUNK_NZ * 2));
-            generate_chunk2(self, xi, yi, zi, li);
-            brick_count = chunk->surface_brick_indices.size();
-            if (chunk->render_chunk == nullptr) {
-                chunk->render_chunk = renderer::create_chunk(g_renderer, (float const *)&chunk->pos);
+    // The renderer only has room for MAX_CHUNK_COUNT chunks, so the ones in view go first and chunks
+    // waiting to be retired are left out if they don't fit
+    auto rendered_count = 0;
+    for (auto in_view : {true, false}) {
+        for (auto &chunk : self->chunks.live_chunks) {
+            if (chunk->render_chunk == nullptr || chunk->surface_brick_indices.empty() || is_chunk_in_view(self, chunk->chunk_i, chunk->level) != in_view) {
+                continue;
+            }
+            if (rendered_count == MAX_CHUNK_COUNT) {
+                return;
             }
-            update(chunk->render_chunk, brick_count, chunk->surface_brick_indices.data(), (void const *const *)chunk->bricks.data(),
-                   offsetof(Brick, bitmask), offsetof(Brick, render_attribs), offsetof(Brick, pos_scl));
-            chunk->bricks_changed = false;
-        }
-
-        if (brick_count > 0) {
             render_chunk(g_renderer, chunk->render_chunk);
+            ++rendered_count;
         }
     }
 }
@@ -1145,37 +1919,53 @@ auto voxel_world::ray_cast(VoxelWorld *self, RayCastConfig const &config) -> Ray
     return RayCastHit{.voxel_x = pos.x, .voxel_y = pos.y, .voxel_z = pos.z, .nrm_x = face.x, .nrm_y = face.y, .nrm_z = face.z, .distance = dist};
 }
 
+// Chunks in view that haven't been generated yet count as solid, so that walking up to the edge of what's
+// streamed in doesn't drop the player through the ground
 auto voxel_world::is_solid(VoxelWorld *self, float const *pos) -> bool {
     auto p = glm::ivec3(glm::vec3(pos[0], pos[1], pos[2]) * VOXEL_SCL);
+    auto chunk_i = get_chunk_i(p);
+    auto lookup = self->chunks.lookup(chunk_i.x, chunk_i.y, chunk_i.z, 0);
+    auto is_generated = lookup.found && (lookup.chunk == nullptr || lookup.chunk->generation_stage != NOT_GENERATED);
+    if (!is_generated && is_chunk_in_view(self, chunk_i, 0)) {
+        return true;
+    }
     return get_voxel_is_solid(self, p);
 }
 
+// Retakes the normals around an edit from the edited densities, with the same central differences
+// over density tiles that generate_attributes uses.
 void fix_normals(VoxelWorld *self, int const *pos) {
-    for (int zi = -16; zi <= 16; ++zi) {
-        for (int yi = -16; yi <= 16; ++yi) {
-            for (int xi = -16; xi <= 16; ++xi) {
-                auto p = glm::ivec3(pos[0], pos[1], pos[2]) + glm::ivec3(xi, yi, zi);
-
-                float dx = get_voxel_sim_attrib(self, p + ivec3(1, 0, 0), true) - get_voxel_sim_attrib(self, p + ivec3(-1, 0, 0), true);
-                float dy = get_voxel_sim_attrib(self, p + ivec3(0, 1, 0), true) - get_voxel_sim_attrib(self, p + ivec3(0, -1, 0), true);
-                float dz = get_voxel_sim_attrib(self, p + ivec3(0, 0, 1), true) - get_voxel_sim_attrib(self, p + ivec3(0, 0, -1), true);
-
-                auto prev_attrib = get_voxel_attrib(self, p);
-                auto nrm = glm::normalize(glm::vec3(dx, dy, dz));
-
-                // glm::vec2 uv0 = fract(glm::vec2(p.y, p.z) * VOXEL_SIZE);
-                // glm::vec2 uv1 = fract(glm::vec2(p.x, p.z) * VOXEL_SIZE);
-                // glm::vec2 uv2 = fract(glm::vec2(p.x, p.y) * VOXEL_SIZE);
-
-                // float uv0_a = abs(dot(nrm, vec3(1, 0, 0)));
-                // float uv1_a = abs(dot(nrm, vec3(0, 1, 0)));
-                // float uv2_a = abs(dot(nrm, vec3(0, 0, 1)));
-
-                // auto col = glm::vec3(1.0, 0.1, 0.1) * uv0_a * uv0_a +
-                //            glm::vec3(0.1, 1.0, 0.1) * uv1_a * uv1_a +
-                //            glm::vec3(0.1, 0.1, 1.0) * uv2_a * uv2_a;
+    auto p0 = glm::ivec3(pos[0], pos[1], pos[2]) - 16;
+    auto p1 = glm::ivec3(pos[0], pos[1], pos[2]) + 16;
+    auto brick_p0 = glm::ivec3(glm::floor(glm::vec3(p0) / float(VOXEL_BRICK_SIZE))) * VOXEL_BRICK_SIZE;
+    auto density_tile = DensityTile{};
+
+    for (int brick_z = brick_p0.z; brick_z <= p1.z; brick_z += VOXEL_BRICK_SIZE) {
+        for (int brick_y = brick_p0.y; brick_y <= p1.y; brick_y += VOXEL_BRICK_SIZE) {
+            for (int brick_x = brick_p0.x; brick_x <= p1.x; brick_x += VOXEL_BRICK_SIZE) {
+                auto brick_p = glm::ivec3(brick_x, brick_y, brick_z);
+                for (int zi = 0; zi < DENSITY_TILE_SIZE; ++zi) {
+                    for (int yi = 0; yi < DENSITY_TILE_SIZE; ++yi) {
+                        for (int xi = 0; xi < DENSITY_TILE_SIZE; ++xi) {
+                            auto tile_index = xi + yi * DENSITY_TILE_SIZE + zi * DENSITY_TILE_SIZE * DENSITY_TILE_SIZE;
+                            density_tile.densities[tile_index] = get_voxel_sim_attrib(self, brick_p + glm::ivec3(xi, yi, zi) - 1, true);
+                        }
+                    }
+                }
 
-                set_voxel_attrib(self, p, Voxel{.col = prev_attrib.col, .nrm = {nrm.x, nrm.y, nrm.z}});
+                auto voxel_p0 = glm::max(p0, brick_p) - brick_p;
+                auto voxel_p1 = glm::min(p1, brick_p + VOXEL_BRICK_SIZE - 1) - brick_p;
+                for (int zi = voxel_p0.z; zi <= voxel_p1.z; ++zi) {
+                    for (int yi = voxel_p0.y; yi <= voxel_p1.y; ++yi) {
+                        for (int xi = voxel_p0.x; xi <= voxel_p1.x; ++xi) {
+                            auto p = brick_p + glm::ivec3(xi, yi, zi);
+                            auto prev_attrib = get_voxel_attrib(self, p);
+                            float nrm[3];
+                            density_tile_normal_cpp(density_tile.densities, xi, yi, zi, nrm);
+                            set_voxel_attrib(self, p, Voxel{.col = prev_attrib.col, .nrm = {nrm[0], nrm[1], nrm[2]}});
+                        }
+                    }
+                }
             }
         }
     }
@@ -10,6 +10,25 @@ namespace voxel_world {
     void destroy(VoxelWorld *self);
 
     void update(VoxelWorld *self);
+    // Chunks get generated around this position (in meters), and retired once they're out of view.
+    void set_view_position(VoxelWorld *self, float const *pos);
+    // Whether every chunk in view has been generated and meshed
+    auto is_view_loaded(VoxelWorld *self) -> bool;
+    // Time per frame spent remeshing edited chunks, the rest is deferred. Zero or less means no limit.
+    void set_remesh_budget(VoxelWorld *self, float milliseconds);
+
+    // Chunks of a coarser level can be built by 2x2x2 reduction of the finer level's chunks while those are
+    // still loaded, which happens when the view moves away from them, instead of evaluating the generator.
+    enum struct LodDownsampling {
+        OFF,
+        // A coarse voxel is solid if at least half of its 8 voxels are
+        MAJORITY,
+        // A coarse voxel is solid if any of its 8 voxels is, which keeps thin features
+        ANY_SOLID,
+    };
+    void set_lod_downsampling(VoxelWorld *self, LodDownsampling mode);
+    // Like set_remesh_budget, for the chunks built by downsampling
+    void set_downsample_budget(VoxelWorld *self, float milliseconds);
     void load_model(VoxelWorld *self, char const *path);
 
     struct RayCastHit {
@@ -0,0 +1,45 @@
+#include <voxels/voxel_world.hpp>
+#include <renderer/renderer.hpp>
+#include <utilities/thread_pool.hpp>
+#include <utilities/debug.hpp>
+
+#include <chrono>
+#include <cstdio>
+
+// The voxel world only hands its meshes to the renderer, so that's left out here
+struct renderer::Chunk {};
+Renderer *g_renderer = nullptr;
+auto renderer::create_chunk(Renderer *, float const *) -> Chunk * {
+    return new Chunk{};
+}
+void renderer::destroy_chunk(Renderer *, Chunk *chunk) {
+    delete chunk;
+}
+void renderer::update(Chunk *, int, VoxelBrickBitmask const *, VoxelRenderAttribBrick const *const *, int const *) {}
+void renderer::render_chunk(Renderer *, Chunk *) {}
+
+Console *g_console = nullptr;
+void debug_utils::add_log(Console *, char const *str) {
+    std::puts(str);
+}
+
+using Clock = std::chrono::steady_clock;
+
+// Times loading the whole view around the origin, the same work as the start of the game: every chunk in
+// view is generated and meshed on the thread pool. Set VOXEL_RASTER_THREADS to compare worker counts.
+auto main() -> int {
+    std::printf("%u workers\n", thread_pool::get_worker_count());
+
+    auto *voxel_world = voxel_world::create();
+    float const view_pos[3] = {0.0f, 0.0f, 0.0f};
+    voxel_world::set_view_position(voxel_world, view_pos);
+    auto t0 = Clock::now();
+    auto frame_count = 0;
+    do {
+        voxel_world::update(voxel_world);
+        ++frame_count;
+    } while (!voxel_world::is_view_loaded(voxel_world));
+    auto seconds = std::chrono::duration<double>(Clock::now() - t0).count();
+    std::printf("view loaded in %.3f s (%d frames)\n", seconds, frame_count);
+    voxel_world::destroy(voxel_world);
+}
@@ -0,0 +1,75 @@
+#include <utilities/thread_pool.hpp>
+#include <utilities/debug.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// thread_pool.cpp logs through the debug console, which isn't around here
+Console *g_console = nullptr;
+void debug_utils::add_log(Console *, char const *str) {
+    std::puts(str);
+}
+
+using Clock = std::chrono::steady_clock;
+
+static void spin(uint32_t iteration_count) {
+    auto volatile sum = uint32_t{};
+    for (uint32_t i = 0; i < iteration_count; ++i) {
+        sum = sum + i;
+    }
+}
+
+// Best of a few runs, in milliseconds
+template <typename F>
+static auto measure(F &&func) -> double {
+    constexpr int RUN_COUNT = 5;
+    auto best = 1e30;
+    for (int run_i = 0; run_i < RUN_COUNT; ++run_i) {
+        auto t0 = Clock::now();
+        func();
+        best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - t0).count());
+    }
+    return best;
+}
+
+constexpr uint32_t ITEM_COUNT = 1 << 16;
+constexpr uint32_t ITEM_COST = 500;
+constexpr uint32_t SPAWN_COUNT = 4096;
+
+static std::vector<thread_pool::Task> s_spawned_tasks;
+
+// Dispatches SPAWN_COUNT small tasks from a worker. They go onto its own deque, so the other workers only
+// get them by stealing.
+static void spawn_tasks(void *) {
+    for (auto task : s_spawned_tasks) {
+        thread_pool::async_dispatch(task);
+    }
+}
+
+// Set VOXEL_RASTER_THREADS to compare worker counts
+auto main() -> int {
+    std::printf("%u workers\n", thread_pool::get_worker_count());
+
+    auto parallel_for_ms = measure([] {
+        thread_pool::parallel_for(0, ITEM_COUNT, 64, [](uint32_t) { spin(ITEM_COST); });
+    });
+    std::printf("parallel_for: %.3f ms (%u items, grain 64)\n", parallel_for_ms, ITEM_COUNT);
+
+    auto spawn_ms = measure([] {
+        s_spawned_tasks.resize(SPAWN_COUNT);
+        for (auto &task : s_spawned_tasks) {
+            task = thread_pool::create_task([](void *) { spin(ITEM_COST * 16); }, nullptr);
+        }
+        auto root = thread_pool::create_task(spawn_tasks, nullptr);
+        thread_pool::async_dispatch(root);
+        thread_pool::wait(root);
+        thread_pool::destroy_task(root);
+        for (auto task : s_spawned_tasks) {
+            thread_pool::wait(task);
+            thread_pool::destroy_task(task);
+        }
+    });
+    std::printf("spawn from a worker: %.3f ms (%u tasks)\n", spawn_ms, SPAWN_COUNT);
+}
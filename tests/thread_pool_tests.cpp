@@ -0,0 +1,130 @@
+#include <utilities/thread_pool.hpp>
+#include <utilities/debug.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+// thread_pool.cpp logs through the debug console, which isn't around here
+Console *g_console = nullptr;
+void debug_utils::add_log(Console *, char const *str) {
+    std::puts(str);
+}
+
+using Clock = std::chrono::steady_clock;
+
+#define CHECK(condition)                                                              \
+    do {                                                                              \
+        if (!(condition)) {                                                           \
+            std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            return false;                                                             \
+        }                                                                             \
+    } while (false)
+
+// Spins until value reaches target, without helping the pool like wait() would
+static auto poll_for(std::atomic_uint32_t const &value, uint32_t target, std::chrono::milliseconds timeout) -> bool {
+    auto const t0 = Clock::now();
+    while (value.load() < target) {
+        if (Clock::now() - t0 > timeout) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// Every worker waits on a task whose dependency is only dispatched once they're all asleep. The dispatch
+// has to wake one of them up, since there's no one else to run the dependency.
+static auto test_wait_in_worker_wakes_on_push() -> bool {
+    static thread_pool::Task s_awaited = {};
+    static std::atomic_uint32_t s_waiters_done = 0;
+    s_waiters_done = 0;
+    s_awaited = thread_pool::create_group();
+    auto dependency = thread_pool::create_task([](void *) {}, nullptr);
+    thread_pool::add_dependency(s_awaited, dependency);
+    thread_pool::async_dispatch(s_awaited);
+    auto waiters = thread_pool::create_batch_task(
+        [](void *, uint32_t) {
+            thread_pool::wait(s_awaited);
+            s_waiters_done.fetch_add(1);
+        },
+        nullptr, thread_pool::get_worker_count());
+    thread_pool::async_dispatch(waiters);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    thread_pool::async_dispatch(dependency);
+    auto const finished = poll_for(s_waiters_done, thread_pool::get_worker_count(), std::chrono::seconds(5));
+    thread_pool::wait(waiters);
+    thread_pool::destroy_task(waiters);
+    thread_pool::destroy_task(dependency);
+    thread_pool::destroy_task(s_awaited);
+    CHECK(finished);
+    return true;
+}
+
+// Drains a task through wait() while every worker is busy, which leaves its queue entry behind, and then
+// dispatches it again behind a dependency. Once a worker gets to the old entry, it mustn't run the new
+// run's chunks before the dependency is done.
+static auto test_redispatch_after_drain_keeps_dependency() -> bool {
+    static std::atomic_uint32_t s_busy_workers = 0;
+    static std::atomic_bool s_release_workers = false;
+    static std::atomic_bool s_dependency_done = false;
+    static std::atomic_bool s_ran_early = false;
+    s_busy_workers = 0;
+    s_release_workers = false;
+    s_dependency_done = false;
+    s_ran_early = false;
+    auto blockers = thread_pool::create_batch_task(
+        [](void *, uint32_t) {
+            s_busy_workers.fetch_add(1);
+            while (!s_release_workers.load()) {
+                std::this_thread::yield();
+            }
+        },
+        nullptr, thread_pool::get_worker_count());
+    thread_pool::async_dispatch(blockers);
+    auto const all_busy = poll_for(s_busy_workers, thread_pool::get_worker_count(), std::chrono::seconds(5));
+    auto task = thread_pool::create_batch_task(
+        [](void *, uint32_t) {
+            if (!s_dependency_done.load()) {
+                s_ran_early = true;
+            }
+        },
+        nullptr, 16);
+    s_dependency_done = true;
+    thread_pool::async_dispatch(task);
+    thread_pool::wait(task);
+    s_dependency_done = false;
+
+    auto dependency = thread_pool::create_task(
+        [](void *) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            s_dependency_done = true;
+        },
+        nullptr);
+    thread_pool::add_dependency(task, dependency);
+    thread_pool::async_dispatch(task);
+    s_release_workers = true;
+    thread_pool::wait(blockers);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    thread_pool::async_dispatch(dependency);
+    thread_pool::wait(task);
+    thread_pool::destroy_task(dependency);
+    thread_pool::destroy_task(task);
+    thread_pool::destroy_task(blockers);
+    CHECK(all_busy);
+    CHECK(!s_ran_early);
+    return true;
+}
+
+auto main() -> int {
+    auto failed_count = 0;
+    auto run = [&](char const *name, auto test) {
+        auto const passed = test();
+        std::printf("%s: %s\n", name, passed ? "passed" : "FAILED");
+        failed_count += passed ? 0 : 1;
+    };
+    run("wait_in_worker_wakes_on_push", test_wait_in_worker_wakes_on_push);
+    run("redispatch_after_drain_keeps_dependency", test_redispatch_after_drain_keeps_dependency);
+    return failed_count == 0 ? 0 : 1;
+}